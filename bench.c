@@ -0,0 +1,553 @@
+/*
+ * bench - Time RCGL's drawing and conversion paths
+ *
+ * bench [palette] [blit] [threads] [cmd] [fill] ...
+ *
+ * Runs the named benchmarks, or all of them:
+ *   palette  Expanding whole frames through the palette with each row
+ *            routine the CPU supports, in Mpixels/s
+ *   blit     rcgl_blit of 8x8 to 256x256 bitmaps, copied, colour keyed and
+ *            remapped, against a pixel at a time, in Mpixels/s
+ *   threads  Whole frame updates from 640x480 to 7680x4320 converted by 1
+ *            to N threads, in Mpixels/s
+ *   cmd      Sprites drawn straight away against recorded in a command list,
+ *            with 1 to N threads, in ms for the fastest frame
+ *   fill     Filled rectangles, circles, triangles and polygons against the
+ *            same shapes plotted a pixel at a time, in fills/s
+ *
+ * rcgl.c is included rather than linked, so the routines picked at runtime
+ * can each be timed on their own. Build with
+ *   gcc -O2 -o bench bench.c -lSDL2
+ */
+#include "rcgl.c"
+
+#include <stdio.h>
+
+#define MINTIME 0.25                   // Seconds to repeat each timing for
+#define BLITW 640                      // Buffer blits are timed drawing into
+#define BLITH 480
+
+static void benchpalette(void);
+static void benchblit(void);
+static void benchthreads(void);
+static void benchcmd(void);
+static void benchfill(void);
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} benches[] = {
+	{ "palette", benchpalette },
+	{ "blit", benchblit },
+	{ "threads", benchthreads },
+	{ "cmd", benchcmd },
+	{ "fill", benchfill },
+};
+#define NBENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+// Frame sizes timed, from Mode 13h up
+static const struct {
+	int w, h;
+} sizes[] = {
+	{ 320, 200 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+};
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+// And for work spread over threads, up to 8K
+static const struct {
+	int w, h;
+} bigsizes[] = {
+	{ 640, 480 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 },
+};
+#define NBIGSIZES (int)(sizeof(bigsizes) / sizeof(bigsizes[0]))
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		int b;
+
+		for (b = 0; b < NBENCHES; b++)
+			if (strcmp(argv[i], benches[b].name) == 0)
+				break;
+		if (b == NBENCHES) {
+			fprintf(stderr, "bench: No benchmark called %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (int b = 0; b < NBENCHES; b++) {
+		int run = argc == 1;
+
+		for (int i = 1; i < argc; i++)
+			run |= strcmp(argv[i], benches[b].name) == 0;
+		if (run)
+			benches[b].run();
+	}
+	return 0;
+}
+
+/*
+ * seconds - Time since the performance counter read t
+ */
+static double seconds(uint64_t t)
+{
+	return (double)(SDL_GetPerformanceCounter() - t)
+	       / SDL_GetPerformanceFrequency();
+}
+
+/*
+ * noise - Fill n bytes with pseudo-random pixels
+ */
+static void noise(uint8_t *b, size_t n)
+{
+	uint32_t s = 12345;
+
+	for (size_t i = 0; i < n; i++) {
+		s = s * 1103515245 + 12345;
+		b[i] = s >> 16;
+	}
+}
+
+/*
+ * benchpalette - Palette expansion by blitrow_c against blitrow_avx2
+ */
+static void benchpalette(void)
+{
+	static const struct {
+		const char *name;
+		void (*fn)(const uint8_t *src, uint32_t *dst, int n,
+		           const uint32_t *lut);
+	} paths[] = {
+		{ "C", blitrow_c },
+#ifdef RCGL_HAVE_AVX2
+		{ "AVX2", blitrow_avx2 },
+#endif
+	};
+	uint32_t lut[256];
+
+	for (int i = 0; i < 256; i++)
+		lut[i] = 0xFF000000 | RCGL_PALETTE_VGA[i];
+
+	printf("Palette expansion, Mpixels/s\n");
+	printf("%-12s", "Size");
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++)
+		printf("%10s", paths[p].name);
+	printf("\n");
+
+	for (int i = 0; i < NSIZES; i++) {
+		int w = sizes[i].w, h = sizes[i].h;
+		uint8_t *src = malloc((size_t)w * h);
+		uint32_t *dst = malloc((size_t)w * h * sizeof(uint32_t));
+		char size[16];
+
+		if (src == NULL || dst == NULL) {
+			fprintf(stderr, "bench: Out of memory\n");
+			exit(1);
+		}
+		noise(src, (size_t)w * h);
+		snprintf(size, sizeof(size), "%dx%d", w, h);
+		printf("%-12s", size);
+
+		for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+			uint64_t t;
+			double s;
+			long frames = 0;
+
+#ifdef RCGL_HAVE_AVX2
+			if (paths[p].fn == blitrow_avx2 && !SDL_HasAVX2()) {
+				printf("%10s", "-");
+				continue;
+			}
+#endif
+			t = SDL_GetPerformanceCounter();
+			do {
+				for (int y = 0; y < h; y++)
+					paths[p].fn(src + (size_t)y * w, dst + (size_t)y * w,
+					            w, lut);
+				frames++;
+			} while ((s = seconds(t)) < MINTIME);
+			printf("%10.0f", (double)frames * w * h / s / 1e6);
+		}
+		printf("\n");
+		free(src);
+		free(dst);
+	}
+}
+
+/*
+ * pixelblit - rcgl_blit as it was, testing and copying a pixel at a time
+ */
+static void pixelblit(rcgl_context *ctx, uint8_t *b, int x, int y, int w,
+                      int h, int trans, uint8_t *plt)
+{
+	uint8_t *fb = rcgl_ctx_getbuf(ctx) + y * BLITW + x;
+
+	for (int r = 0; r < h; r++) {
+		for (int c = 0; c < w; c++) {
+			uint8_t p = plt ? plt[*b] : *b;
+			if (trans < 0 || p != trans)
+				*fb = p;
+			b++;
+			fb++;
+		}
+		fb += BLITW - w;
+	}
+}
+
+/*
+ * benchblit - rcgl_blit's row copy, keyed and remapped paths, by size
+ */
+static void benchblit(void)
+{
+	static const struct {
+		const char *name;
+		int trans;
+		int remap;
+	} paths[] = {
+		{ "Copy", -1, 0 }, { "Keyed", 0, 0 }, { "Remap", 0, 1 },
+	};
+	static const struct {
+		const char *name;
+		void (*fn)(rcgl_context *ctx, uint8_t *b, int x, int y, int w,
+		           int h, int trans, uint8_t *plt);
+	} ways[] = {
+		{ "pixel", pixelblit }, { "rcgl", rcgl_ctx_blit },
+	};
+	rcgl_context *ctx;
+	uint8_t *spr, plt[256];
+
+	if ((ctx = rcgl_ctx_init(BLITW, BLITH, 0, 0, NULL, RCGL_HEADLESS))
+	    == NULL)
+		exit(1);
+	if ((spr = malloc(256 * 256)) == NULL) {
+		fprintf(stderr, "bench: Out of memory\n");
+		exit(1);
+	}
+	// A quarter of the pixels are transparent, in runs as in real sprites
+	noise(spr, 256 * 256);
+	for (int i = 0; i < 256 * 256; i++)
+		if ((i / 3 + spr[i / 16]) % 4 == 0)
+			spr[i] = 0;
+	noise(plt, 256);
+
+	printf("Blits into %dx%d, Mpixels/s\n", BLITW, BLITH);
+	printf("%-10s", "");
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++)
+		printf("%18s", paths[p].name);
+	printf("\n%-10s", "Size");
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++)
+		for (size_t k = 0; k < sizeof(ways) / sizeof(ways[0]); k++)
+			printf("%9s", ways[k].name);
+	printf("\n");
+
+	for (int n = 8; n <= 256; n *= 2) {
+		char size[16];
+
+		snprintf(size, sizeof(size), "%dx%d", n, n);
+		printf("%-10s", size);
+		for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+			for (size_t k = 0; k < sizeof(ways) / sizeof(ways[0]); k++) {
+				uint64_t t = SDL_GetPerformanceCounter();
+				long blits = 0;
+				double s;
+
+				// Spread over the buffer so they aren't all in cache
+				do {
+					for (int i = 0; i < 64; i++, blits++)
+						ways[k].fn(ctx, spr, blits * 37 % (BLITW - n),
+						           blits * 53 % (BLITH - n), n, n,
+						           paths[p].trans,
+						           paths[p].remap ? plt : NULL);
+				} while ((s = seconds(t)) < MINTIME);
+				printf("%9.0f", (double)blits * n * n / s / 1e6);
+			}
+		}
+		printf("\n");
+	}
+	free(spr);
+	rcgl_ctx_quit(ctx);
+}
+
+/*
+ * morethreads - Double the threads, stopping at most on the way
+ */
+static int morethreads(int n, int most)
+{
+	return (n < most && n * 2 > most) ? most : n * 2;
+}
+
+/*
+ * benchthreads - Whole frame updates split across more and more threads
+ * Goes up to the CPU count, or 4 if there are fewer to show what it costs.
+ */
+static void benchthreads(void)
+{
+	int cpus = SDL_GetCPUCount();
+	int most = cpus > 4 ? cpus : 4;
+
+	printf("Headless updates, Mpixels/s, %d CPUs\n", cpus);
+	printf("%-12s", "Threads");
+	for (int n = 1; n <= most; n = morethreads(n, most))
+		printf("%8d", n);
+	printf("\n");
+
+	for (int i = 0; i < NBIGSIZES; i++) {
+		int w = bigsizes[i].w, h = bigsizes[i].h;
+		rcgl_context *ctx;
+		char size[16];
+
+		ctx = rcgl_ctx_init(w, h, 0, 0, NULL,
+		                    RCGL_HEADLESS | RCGL_DIRTYRECT);
+		if (ctx == NULL)
+			exit(1);
+		noise(rcgl_ctx_getbuf(ctx), (size_t)w * h);
+		snprintf(size, sizeof(size), "%dx%d", w, h);
+		printf("%-12s", size);
+
+		for (int n = 1; n <= most; n = morethreads(n, most)) {
+			uint64_t t;
+			long frames = 0;
+			double s;
+
+			rcgl_setthreads(n);
+			rcgl_ctx_invalidate(ctx, 0, 0, w, h);
+			rcgl_ctx_update(ctx);      // Starts the workers untimed
+			t = SDL_GetPerformanceCounter();
+			do {
+				rcgl_ctx_invalidate(ctx, 0, 0, w, h);
+				rcgl_ctx_update(ctx);
+				frames++;
+			} while ((s = seconds(t)) < MINTIME);
+			printf("%8.0f", (double)frames * w * h / s / 1e6);
+			fflush(stdout);
+		}
+		printf("\n");
+		rcgl_ctx_quit(ctx);
+	}
+	rcgl_setthreads(1);
+}
+
+/*
+ * benchcmd - Sprites drawn directly against run from a command list
+ * Twice the buffer's area in 40x30 sprites, at the same spots each frame.
+ * The fastest frame is taken, as the slower ones are mostly interruptions.
+ */
+static void benchcmd(void)
+{
+	int cpus = SDL_GetCPUCount();
+	int most = cpus > 4 ? cpus : 4;
+	uint8_t bits[40 * 30];
+	rcgl_sprite *spr;
+	rcgl_cmdlist *l;
+
+	noise(bits, sizeof(bits));
+	for (size_t i = 0; i < sizeof(bits); i++)
+		if (bits[i] < 64)
+			bits[i] = 0;
+	if ((spr = rcgl_sprite_compile(bits, 40, 30, 0)) == NULL
+	    || (l = rcgl_cmd_create()) == NULL)
+		exit(1);
+
+	printf("Sprites drawn, ms for the fastest frame, %d CPUs\n", cpus);
+	printf("%-12s%8s", "", "Direct");
+	for (int n = 1; n <= most; n = morethreads(n, most))
+		printf("%6s %d", "List", n);
+	printf("\n");
+
+	for (int i = 0; i < NBIGSIZES; i++) {
+		int w = bigsizes[i].w, h = bigsizes[i].h;
+		int nspr = w * h * 2 / (40 * 30);
+		rcgl_context *ctx;
+		uint64_t t;
+		double s, best;
+		char size[16];
+
+		if ((ctx = rcgl_ctx_init(w, h, 0, 0, NULL, RCGL_HEADLESS)) == NULL)
+			exit(1);
+		snprintf(size, sizeof(size), "%dx%d", w, h);
+		printf("%-12s", size);
+
+		rcgl_setthreads(1);
+		t = SDL_GetPerformanceCounter();
+		best = MINTIME;
+		do {
+			uint64_t f = SDL_GetPerformanceCounter();
+
+			for (int j = 0; j < nspr; j++)
+				rcgl_ctx_sprite_draw(ctx, spr, j * 7919 % (w + 40) - 40,
+				                     j * 104729 % (h + 30) - 30, NULL);
+			if ((s = seconds(f)) < best)
+				best = s;
+		} while (seconds(t) < MINTIME);
+		printf("%8.2f", best * 1000);
+
+		for (int n = 1; n <= most; n = morethreads(n, most)) {
+			rcgl_setthreads(n);
+			t = SDL_GetPerformanceCounter();
+			best = MINTIME;
+			do {
+				uint64_t f = SDL_GetPerformanceCounter();
+
+				for (int j = 0; j < nspr; j++)
+					rcgl_cmd_sprite(l, spr, j * 7919 % (w + 40) - 40,
+					                j * 104729 % (h + 30) - 30, NULL);
+				rcgl_ctx_cmd_run(ctx, l);
+				if ((s = seconds(f)) < best)
+					best = s;
+			} while (seconds(t) < MINTIME);
+			printf("%8.2f", best * 1000);
+			fflush(stdout);
+		}
+		printf("\n");
+		rcgl_ctx_quit(ctx);
+	}
+	rcgl_setthreads(1);
+	rcgl_cmd_free(l);
+	rcgl_sprite_free(spr);
+}
+
+// Shapes filled by benchfill, about 100 pixels across, and a star to be
+// concave
+static const int tri[6] = { 0, 0, 99, 30, 40, 99 };
+static const int star[20] = {
+	50, 0, 61, 35, 98, 35, 68, 57, 79, 91, 50, 70, 21, 91, 32, 57, 2, 35,
+	39, 35,
+};
+
+/*
+ * plotrect - Fill a 100x100 rectangle at x,y with rcgl_plot
+ */
+static void plotrect(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	for (int j = 0; j < 100; j++)
+		for (int i = 0; i < 100; i++)
+			rcgl_ctx_plot(ctx, x + i, y + j, c);
+}
+
+/*
+ * plotcircle - Fill a circle of radius 50 centred on x,y with rcgl_plot
+ */
+static void plotcircle(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	for (int j = -50; j <= 50; j++)
+		for (int i = -50; i <= 50; i++)
+			if (i * i + j * j <= 50 * 50)
+				rcgl_ctx_plot(ctx, x + i, y + j, c);
+}
+
+/*
+ * plottri - Fill tri at x,y with rcgl_plot, testing each pixel's centre
+ * against the three edges
+ */
+static void plottri(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	for (int j = 0; j < 100; j++) {
+		for (int i = 0; i < 100; i++) {
+			int in = 1;
+
+			for (int e = 0; e < 3; e++) {
+				const int *a = &tri[e * 2], *b = &tri[(e + 1) % 3 * 2];
+				if ((b[0] - a[0]) * (2 * j + 1 - 2 * a[1])
+				    - (b[1] - a[1]) * (2 * i + 1 - 2 * a[0]) > 0)
+					in = 0;
+			}
+			if (in)
+				rcgl_ctx_plot(ctx, x + i, y + j, c);
+		}
+	}
+}
+
+/*
+ * plotstar - Fill star at x,y with rcgl_plot, counting the edges crossed
+ * to the left of each pixel's centre
+ */
+static void plotstar(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	for (int j = 0; j < 100; j++) {
+		for (int i = 0; i < 100; i++) {
+			double px = i + 0.5, py = j + 0.5;
+			int in = 0;
+
+			for (int e = 0, f = 9; e < 10; f = e++) {
+				double x1 = star[e * 2], y1 = star[e * 2 + 1];
+				double x2 = star[f * 2], y2 = star[f * 2 + 1];
+				if ((y1 > py) != (y2 > py)
+				    && px < x1 + (py - y1) * (x2 - x1) / (y2 - y1))
+					in = !in;
+			}
+			if (in)
+				rcgl_ctx_plot(ctx, x + i, y + j, c);
+		}
+	}
+}
+
+static void fillrect(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	rcgl_ctx_fillrect(ctx, x, y, 100, 100, c);
+}
+
+static void fillcircle(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	rcgl_ctx_fillcircle(ctx, x, y, 50, c);
+}
+
+static void filltri(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	rcgl_ctx_filltriangle(ctx, x + tri[0], y + tri[1], x + tri[2], y + tri[3],
+	                      x + tri[4], y + tri[5], c);
+}
+
+static void fillstar(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	int xy[20];
+
+	for (int i = 0; i < 20; i += 2) {
+		xy[i] = x + star[i];
+		xy[i + 1] = y + star[i + 1];
+	}
+	rcgl_ctx_fillpolygon(ctx, xy, 10, c);
+}
+
+/*
+ * benchfill - Filled shapes against the rcgl_plot loops they replace
+ */
+static void benchfill(void)
+{
+	static const struct {
+		const char *name;
+		void (*fill)(rcgl_context *ctx, int x, int y, uint8_t c);
+		void (*plot)(rcgl_context *ctx, int x, int y, uint8_t c);
+	} shapes[] = {
+		{ "Rectangle", fillrect, plotrect },
+		{ "Circle", fillcircle, plotcircle },
+		{ "Triangle", filltri, plottri },
+		{ "Star", fillstar, plotstar },
+	};
+	rcgl_context *ctx;
+
+	if ((ctx = rcgl_ctx_init(BLITW, BLITH, 0, 0, NULL, RCGL_HEADLESS))
+	    == NULL)
+		exit(1);
+
+	printf("Shapes about 100 pixels across, fills/s\n");
+	printf("%-12s%12s%12s\n", "Shape", "rcgl_plot", "Filled");
+	for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+		printf("%-12s", shapes[i].name);
+		for (int k = 0; k < 2; k++) {
+			void (*fn)(rcgl_context *, int, int, uint8_t) =
+				k ? shapes[i].fill : shapes[i].plot;
+			uint64_t t = SDL_GetPerformanceCounter();
+			long fills = 0;
+			double s;
+
+			do {
+				for (int j = 0; j < 64; j++, fills++)
+					fn(ctx, 50 + fills * 37 % (BLITW - 200),
+					   50 + fills * 53 % (BLITH - 200), fills);
+			} while ((s = seconds(t)) < MINTIME);
+			printf("%12.0f", fills / s);
+		}
+		printf("\n");
+	}
+	rcgl_ctx_quit(ctx);
+}
@@ -0,0 +1,235 @@
+/*
+ * pack - Pack 8-bit BMPs into an RCGL asset pack
+ *
+ * pack [-b] out.pak [-k index] [-p] file.bmp ...
+ *
+ * Each BMP becomes a bitmap named after the file, without its directory or
+ * extension. Options apply to the files after them:
+ *   -k index  Also pack the runs of following bitmaps keyed on index, so
+ *             rcgl_pak_sprite can draw them. -1 stops again.
+ *   -p        Also pack the palettes of following BMPs, as name.pal
+ *   -b        Once packed, time loading the BMPs against opening the pack
+ */
+#include "rcgl.h"
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 20
+
+struct ASSET {
+	const char *path;
+	char name[32];
+	char palname[32];
+	int trans;
+	int haspal;
+};
+
+static int loadbmp(const char *path, uint8_t **pix, int *w, int *h,
+                   uint32_t *pal);
+static void basename32(char *name, const char *path, const char *suffix);
+static void bench(const char *out, const struct ASSET *a, int n);
+
+int main(int argc, char **argv)
+{
+	struct ASSET *a;
+	rcgl_pakitem *items;
+	uint8_t **pix;
+	uint32_t (*pals)[256];
+	const char *out = NULL;
+	int n = 0, nitems = 0;
+	int trans = -1, palettes = 0, dobench = 0;
+	int rval = 1;
+
+	a = calloc(argc, sizeof(*a));
+	items = calloc(argc * 2, sizeof(*items));
+	pix = calloc(argc, sizeof(*pix));
+	pals = calloc(argc, sizeof(*pals));
+	if (!a || !items || !pix || !pals) {
+		fprintf(stderr, "pack: Out of memory\n");
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0)
+			dobench = 1;
+		else if (strcmp(argv[i], "-p") == 0)
+			palettes = 1;
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			trans = atoi(argv[++i]);
+		else if (out == NULL)
+			out = argv[i];
+		else {
+			a[n].path = argv[i];
+			a[n].trans = trans;
+			a[n].haspal = palettes;
+			basename32(a[n].name, argv[i], "");
+			basename32(a[n].palname, argv[i], ".pal");
+			n++;
+		}
+	}
+	if (out == NULL || n == 0) {
+		fprintf(stderr, "usage: pack [-b] out.pak [-k index] [-p] "
+		        "file.bmp ...\n");
+		return 1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		int w, h;
+
+		if (loadbmp(a[i].path, &pix[i], &w, &h, pals[i]) < 0)
+			goto done;
+		items[nitems].name = a[i].name;
+		items[nitems].type = RCGL_PAK_BITMAP;
+		items[nitems].data = pix[i];
+		items[nitems].w = w;
+		items[nitems].h = h;
+		items[nitems].trans = a[i].trans;
+		nitems++;
+		if (a[i].haspal) {
+			items[nitems].name = a[i].palname;
+			items[nitems].type = RCGL_PAK_PALETTE;
+			items[nitems].data = pals[i];
+			nitems++;
+		}
+	}
+	if (rcgl_pak_write(out, items, nitems) < 0)
+		goto done;
+	printf("Packed %d assets into %s\n", nitems, out);
+
+	if (dobench)
+		bench(out, a, n);
+	rval = 0;
+
+done:
+	for (int i = 0; i < n; i++)
+		free(pix[i]);
+	free(pals);
+	free(pix);
+	free(items);
+	free(a);
+	return rval;
+}
+
+/*
+ * loadbmp - Load an 8-bit BMP into w x h pixels and its palette
+ */
+static int loadbmp(const char *path, uint8_t **pix, int *w, int *h,
+                   uint32_t *pal)
+{
+	SDL_Surface *s;
+	SDL_Palette *sp;
+
+	if ((s = SDL_LoadBMP(path)) == NULL) {
+		fprintf(stderr, "pack: Failed to load %s: %s\n", path,
+		        SDL_GetError());
+		return -1;
+	}
+	sp = s->format->palette;
+	if (s->format->BitsPerPixel != 8 || sp == NULL) {
+		fprintf(stderr, "pack: %s isn't an 8-bit BMP\n", path);
+		SDL_FreeSurface(s);
+		return -1;
+	}
+	if ((*pix = malloc((size_t)s->w * s->h)) == NULL) {
+		fprintf(stderr, "pack: Out of memory\n");
+		SDL_FreeSurface(s);
+		return -1;
+	}
+	for (int y = 0; y < s->h; y++)
+		memcpy(*pix + (size_t)y * s->w,
+		       (uint8_t *)s->pixels + (size_t)y * s->pitch, s->w);
+	memset(pal, 0, 256 * sizeof(uint32_t));
+	for (int i = 0; i < sp->ncolors && i < 256; i++)
+		pal[i] = (uint32_t)sp->colors[i].r << 16
+		       | (uint32_t)sp->colors[i].g << 8 | sp->colors[i].b;
+	*w = s->w;
+	*h = s->h;
+	SDL_FreeSurface(s);
+	return 0;
+}
+
+/*
+ * basename32 - Name an asset after its file, with suffix added
+ */
+static void basename32(char *name, const char *path, const char *suffix)
+{
+	const char *b = path, *dot;
+	size_t len;
+
+	for (const char *c = path; *c; c++)
+		if (*c == '/' || *c == '\\')
+			b = c + 1;
+	dot = strrchr(b, '.');
+	len = dot ? (size_t)(dot - b) : strlen(b);
+	if (len > 31 - strlen(suffix))
+		len = 31 - strlen(suffix);
+	memcpy(name, b, len);
+	strcpy(name + len, suffix);
+}
+
+/*
+ * bench - Time decoding the BMPs as an app would, against opening the pack
+ */
+static void bench(const char *out, const struct ASSET *a, int n)
+{
+	double freq = SDL_GetPerformanceFrequency() / 1000.0;
+	uint64_t t, tbmp = 0, tpak = 0, ttouch = 0;
+	volatile unsigned sum = 0;         // So none of the work is skipped
+
+	for (int r = 0; r < ROUNDS; r++) {
+		rcgl_pak *p;
+
+		// Decode into malloc'd buffers, compiling sprites as they go
+		t = SDL_GetPerformanceCounter();
+		for (int i = 0; i < n; i++) {
+			uint32_t pal[256];
+			uint8_t *pix;
+			int w, h;
+
+			if (loadbmp(a[i].path, &pix, &w, &h, pal) < 0)
+				return;
+			if (a[i].trans >= 0)
+				rcgl_sprite_free(rcgl_sprite_compile(pix, w, h,
+				                                     a[i].trans));
+			sum += pix[0] + pal[0];
+			free(pix);
+		}
+		tbmp += SDL_GetPerformanceCounter() - t;
+
+		// Open the pack and look every asset up
+		t = SDL_GetPerformanceCounter();
+		if ((p = rcgl_pak_open(out)) == NULL)
+			return;
+		for (int i = 0; i < n; i++) {
+			int k = rcgl_pak_find(p, a[i].name);
+			if (a[i].trans >= 0)
+				sum += rcgl_pak_sprite(p, k) != NULL;
+			else
+				sum += rcgl_pak_bitmap(p, k, NULL, NULL) != NULL;
+			if (a[i].haspal)
+				sum += rcgl_pak_palette(p,
+				       rcgl_pak_find(p, a[i].palname)) != NULL;
+		}
+		tpak += SDL_GetPerformanceCounter() - t;
+
+		// Then fault in every cache line of pixels, as drawing them would
+		t = SDL_GetPerformanceCounter();
+		for (int i = 0; i < n; i++) {
+			int w, h;
+			const uint8_t *b = rcgl_pak_bitmap(p,
+			                   rcgl_pak_find(p, a[i].name), &w, &h);
+			for (size_t j = 0; j < (size_t)w * h; j += 64)
+				sum += b[j];
+		}
+		ttouch += SDL_GetPerformanceCounter() - t;
+		rcgl_pak_close(p);
+	}
+
+	printf("Loading %d BMPs:        %8.3f ms\n", n, tbmp / freq / ROUNDS);
+	printf("Opening the pack:      %8.3f ms\n", tpak / freq / ROUNDS);
+	printf("  then reading pixels: %8.3f ms\n", ttouch / freq / ROUNDS);
+}
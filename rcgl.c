@@ -35,42 +35,521 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <SDL2/SDL.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+// AVX2 palette expansion is compiled in per-function and picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RCGL_HAVE_AVX2
+#define RCGL_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define RCGL_HAVE_AVX2
+#define RCGL_TARGET_AVX2
+#endif
+
+// SSE2 is part of every x86-64 CPU, so colour keying uses it unconditionally
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RCGL_HAVE_SSE2
+#endif
+
+// Shared framebuffers need POSIX shared memory, and asset packs are mapped
+// rather than read in where files can be
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RCGL_HAVE_SHM
+#define RCGL_HAVE_MMAP
+#endif
+
+// Processes sharing a framebuffer sleep on its header's counters with
+// futexes where there are any, and poll them otherwise
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define RCGL_HAVE_FUTEX
+#endif
 
 /* LIBRARY STATE */
-static SDL_Window *wind;
-static SDL_Renderer *rend;
-static SDL_Texture *tx;
-static SDL_Thread *thread;
 
-static SDL_cond *initcond;
-static SDL_cond *waitdrawcond;
-static SDL_mutex *mutex;
-static int initstatus;
-static int drawstatus;
+// Damaged regions of the buffer, only tracked with RCGL_DIRTYRECT
+#define MAXDIRTY 16
 
-static SDL_atomic_t status;
+// Ring of frames handed off by rcgl_submit
+#define NFRAMES 3
 
-static uint32_t EVENT_TERM;
-static uint32_t EVENT_REDRAW;
+// Frame capture, queued by the drawing thread and written by capthread
+#define CAPFRAMES 8
+
+// Palette animations, run on each update
+#define MAXPALANIM 16
+#define MAXPALKEYS 65536               // Most keyframes, so sizes fit an int
+
+// Counters in a shared framebuffer's header, changed with SDL's atomics
+#define SHMATOM(v) ((SDL_atomic_t *)&(v))
+#define SHMBUFOFF ((sizeof(rcgl_shm) + 63) & ~(size_t)63)
+#define SHMSLEEP 100                   // Longest a futex sleep goes, in ms
+
+// Input, written by the video thread and read without locking
+#define EVQ 256                        // Power of two
+
+// Frame timing, in performance counter ticks
+#define STATWIN 128                    // Frames the stats are taken over
+
+// Presentation
+#define SPINMS 2                       // Spin rather than sleep this close
+
+// Everything belonging to one window, or one headless buffer
+struct rcgl_context {
+	SDL_Window *wind;
+	SDL_Renderer *rend;
+	SDL_Texture *tx;
+	int surfmode;                      // Blit to window surface, no renderer
+	SDL_Surface *isurf;                // 8-bit surface over the frame
+	SDL_Surface *wsurf;                // Window surface
+	SDL_Surface *ssurf;                // Converted frame when it's scaled
+	SDL_Rect sdst;                     // Where the frame goes in the window
+	int outw, outh;                    // Window size in output pixels
+	int direct;                        // Converting straight into wsurf
+	int txw, txh, txsharp;             // Texture as made by layout()
+	const uint8_t *lastsrc;            // Frame last converted, or NULL once
+	                                   // it's gone, under mutex
+	rcgl_context *nextwin;             // Next window served by the thread
+
+	// Scaler, mode and aspect are asked for under mutex and used by the
+	// video thread from its next frame
+	int scalemode, aspw, asph;
+	int wantscale, wantaspw, wantasph;
+	int relayout;                      // The ones asked for have changed
+	int *xpos, *ypos;                  // Where each buffer column and row
+	                                   // starts once converted
+	int xrep;                          // Columns all this wide, or 0 if not
+	int scaled;                        // xpos and ypos aren't one to one
+
+	SDL_cond *initcond;
+	SDL_cond *waitdrawcond;
+	SDL_mutex *mutex;
+	int initstatus;                    // 1 once the window is up, or error
+	int drawstatus;
+
+	SDL_atomic_t status;
+
+	uint32_t *palette;                 // rcgl_palette, or ownpal
+	uint32_t ownpal[256];
+	int bw;                            // Buffer width
+	int bh;                            // Buffer height
+	uint8_t *buf;                      // Pointer to user buffer
+	uint8_t *ibuf;                     // Internal/Default user buffer
+	int headless;                      // No window, render to hbuf instead
+	int cx1, cy1, cx2, cy2;            // Drawing clip, x2/y2 exclusive
+	uint32_t *hbuf;                    // ARGB output when headless
+
+	uint32_t plut[256];                // Palette snapshot used by blit()
+	uint8_t *shadow;                   // Last frame, to find changed rows
+	int irowmin[256], irowmax[256];    // Rows each palette entry is used in
+	const uint8_t *irowsrc;            // Frame irowmin/irowmax are valid for
+
+	// Layers behind the buffer, composited while converting. Each frame
+	// takes a copy, like the palette.
+	struct LAYERS {
+		struct LAYER {
+			const uint8_t *b;          // Or NULL when not set
+			int w, h;
+			int sx, sy;                // Scroll, wrapped into the layer
+			int trans;
+		} l[RCGL_MAXLAYERS];
+		int n;                         // Highest layer set, plus one
+		int key;                       // Buffer index the layers show through
+	} layers, ulayers, flayers[NFRAMES];
+	const struct LAYERS *drawlayers;   // Copy the frame being drawn uses
+	uint8_t *cbuf;                     // Composited frame for SDL's blitter
+
+	int dirtymode;
+	SDL_Rect dirty[MAXDIRTY];          // Damage since the last update
+	int ndirty;
+	SDL_Rect udirty[MAXDIRTY];         // Damage handed to video thread
+	int nudirty;
+
+	// Frames handed off by rcgl_submit, guarded by mutex
+	uint8_t *fring[NFRAMES];           // Copies of submitted buffers
+	uint32_t fpal[NFRAMES][256];       // Palette at time of submission
+	int fpending;                      // Latest submitted frame, not yet taken
+	int fbusy;                         // Frame being drawn by video thread
+	uint32_t fpendingid;
+	uint32_t fupdateid;                // Frame requested by rcgl_update
+	uint32_t fsubmitted;               // Id of last submitted frame
+	SDL_atomic_t fpresented;           // Id of last presented frame
+
+	struct CAPFRAME {
+		uint8_t *pix;
+		uint32_t pal[256];
+		int palchanged;                // Write a palette record first
+		uint32_t ticks;
+	} capq[CAPFRAMES];
+	SDL_Thread *capthr;
+	SDL_mutex *capmutex;
+	SDL_cond *capcond;
+	FILE *capfile;
+	int caphead, capcount;             // Queue of frames waiting to be written
+	int capstop;                       // Writer should finish up and exit
+	int caperror;                      // A write has failed
+	SDL_atomic_t capdropped;           // Frames the writer couldn't take
+	uint32_t caplastpal[256];          // Palette of the last queued frame
+	int caphaspal;
+
+	struct PALANIM {
+		int used;
+		int first, last;               // Range of entries animated
+		uint32_t start;                // Ticks when started
+		int ms;                        // Cycle: time per step, sign is way
+		int steps;                     // Cycle: steps applied so far
+		uint32_t *keys;                // Keyframes: n palettes then n times
+		int nkeys;
+		int loop;
+	} palanim[MAXPALANIM];
+
+	rcgl_cmdlist *deferred;            // Lists to run at the next update
+
+	// Polygon edges, kept between fills
+	struct EDGE {
+		int x1, y1, x2, y2;            // y1 < y2
+	} *edges;
+	struct EDGE **active;
+	int *xcross;
+	int nedges;                        // Space allocated for
+
+	const rcgl_font *font;
+
+	rcgl_event evq[EVQ];               // Events not yet polled
+	SDL_atomic_t evhead;               // Next slot the video thread fills
+	SDL_atomic_t evtail;               // Next slot rcgl_pollevent reads
+	rcgl_input instate;                // Video thread's own copy
+	rcgl_input inbuf[3];               // Snapshots, swapped between threads
+	SDL_atomic_t inmid;                // Spare snapshot, bit 2 set when new
+	int inback;                        // Snapshot the video thread fills
+	int infront;                       // Snapshot rcgl_getinput reads
+
+	// Stage timings, kept under mutex
+	struct STAGE {
+		uint64_t t[STATWIN];           // Most recent durations
+		int n, next;
+	} stages[RCGL_NUMSTAGES];
+	struct FTIME {
+		uint64_t start, dur;           // First start and total, this frame
+	} ftimes[RCGL_NUMSTAGES];          // Only touched by the drawing thread
+	uint64_t fpushtime;                // When the last redraw was requested
+	uint64_t lastpresent;
+	uint32_t fshown, fdropped;
+	FILE *tracefile;
+	struct TRACEEV {
+		uint64_t start, dur;
+		int stage;
+	} *trace;                          // Trace events waiting to be written
+	int ntrace, tracecap;
+	uint64_t tracebase;
+
+	SDL_atomic_t wantvsync;            // Mode asked for by rcgl_setvsync
+	SDL_atomic_t pacehz;               // Rate for RCGL_VSYNC_FIXED
+	int vsyncmode;                     // Mode the video thread is using
+	uint64_t pacedeadline;             // When the next fixed rate frame is due
+	uint64_t waitdeadline;             // Next rcgl_frame_wait deadline
+	int waithz;
+
+	// Shared framebuffer from rcgl_shm_create
+	rcgl_shm *shm;
+	char *shmname;
+	size_t shmsize;                    // As mapped, the header isn't trusted
+	uint32_t *shmoldpal;               // Palette to go back to
+	rcgl_shm *shmwatch;                // Watched by the video thread, and
+	int shmbusy;                       // being drawn from, under mutex
+	SDL_Thread *shmthread;             // Waits for posts, wakes video thread
+	SDL_atomic_t shmstop;
+	SDL_atomic_t shmqueued;            // EVENT_SHM pushed, not yet taken
+
+	struct CARGS {
+		int w, h, ww, wh;
+		const char *title;
+		int wflags;
+	} cargs;
+};
 
 uint32_t rcgl_palette[256];
-static int bw;                  // Buffer width
-static int bh;                  // Buffer height
-static uint8_t *buf;                   // Pointer to user buffer
-static uint8_t *ibuf;                  // Internal/Default user buffer
-static int running;				// Is the video thread still alive
+static rcgl_context defctx;            // Used by the calls without a context
+
+// One thread handles the events of every window, and draws to them
+static SDL_SpinLock ctxlockmade;      // Guards creating ctxlock
+static SDL_mutex *ctxlock;             // Guards everything up to windows
+static SDL_Thread *evthread;
+static int nwindows;                   // Contexts with a window
+static int ncontexts;                  // All contexts, headless or not
+static rcgl_context *windows;          // Only touched by evthread
+
+// Regions mapped by rcgl_shm_attach, at the size checked when attaching
+#ifdef RCGL_HAVE_SHM
+static struct SHMMAP {
+	rcgl_shm *s;
+	size_t size;
+	struct SHMMAP *next;
+} *shmmaps;
+static SDL_SpinLock shmmaplock;
+#endif
+
+static uint32_t EVENT_TERM;
+static uint32_t EVENT_REDRAW;          // Context in data1
+static uint32_t EVENT_CREATE;
+static uint32_t EVENT_DESTROY;
+static uint32_t EVENT_SHM;             // Frame posted to context in data1
 
-static struct CARGS {
-	int w, h, ww, wh;
-	const char *title;
-	int wflags;
-} cargs;
+// Palette expansion for a single row, selected at init for the running CPU
+static void (*blitrow)(const uint8_t *src, uint32_t *dst, int n,
+                       const uint32_t *lut);
+
+// Worker threads sharing palette conversion with the rendering threads
+#define MAXTHREADS 64
+#define POOLMIN (64*1024)              // Fewer pixels aren't worth splitting
+static SDL_atomic_t wantthreads;       // Threads requested by rcgl_setthreads
+static struct POOL {
+	SDL_SpinLock lock;                 // Held by the context using the workers
+	SDL_Thread *thr[MAXTHREADS];
+	int n;                             // Workers, not counting the renderer
+	SDL_sem *start;                    // Posted once per worker for each job
+	SDL_sem *done;                     // Posted by each worker when finished
+	int quit;
+	// Current job, split into bands of rows
+	void (*job)(void);                 // Run by every thread to take bands
+	rcgl_context *ctx;
+	const uint8_t *src;
+	uint8_t *dst;
+	int pitch;
+	const SDL_Rect *r;
+	rcgl_cmdlist *cmds;                // Or the command list being run
+	int bands;
+	SDL_atomic_t next;                 // Next band to be taken
+} pool;
+
+// Sprite pre-compiled into runs of opaque pixels
+struct rcgl_sprite {
+	int w, h;
+	uint32_t *rows;                    // Offset of each row's runs in data
+	uint8_t *data;                     // Per row a 16-bit run count, then per
+	                                   // run 16-bit skip and length, pixels
+};
+
+// Sprite sheet, every frame cut out of the one bitmap
+struct rcgl_atlas {
+	int w, h;
+	uint8_t *pix;                      // w x h, allocated with the atlas
+	struct FRAME {
+		int x, y, w, h;
+		char *name;                    // Or NULL
+	} *frames;
+	int nframes, cap;
+};
+
+// Asset pack file, in the byte order of the machine that packed it. After
+// the header comes the directory, then the directory's order by name, then
+// every palette, bitmap and sprite's runs each at a multiple of PAKALIGN.
+#define PAKALIGN 64
+#define PAKMAGIC "RCGLPAK"
+#define PAKORDER 0x01020304
+struct PAKHEAD {
+	char magic[8];
+	uint32_t version;                  // 1
+	uint32_t order;                    // PAKORDER as packed
+	uint32_t count;                    // Directory entries
+	uint32_t size;                     // Whole file
+	uint32_t pad[2];
+};
+struct PAKENTRY {
+	char name[32];                     // NUL terminated
+	uint32_t type;
+	int32_t w, h;
+	int32_t trans;                     // Key the runs were made with, or -1
+	uint32_t off;                      // Palette or pixels
+	uint32_t runoff, runsize;          // Sprite rows then data, or 0
+	uint32_t pad;
+};
+
+// An asset pack, mapped or read in whole
+struct rcgl_pak {
+	uint8_t *map;
+	size_t size;
+	const struct PAKENTRY *ents;
+	const uint32_t *byname;            // Entry numbers sorted by name
+	int count;
+	struct rcgl_sprite *sprites;       // Made as asked for, w is 0 till then
+};
+
+// Recorded drawing commands, run a band of rows at a time
+#define BAND 64
+#define BINMIN (2*1024*1024)           // Smaller buffers stay in cache anyway
+enum { CMD_PLOT, CMD_LINE, CMD_BLIT, CMD_SPRITE };
+struct CMD {
+	uint8_t type;
+	uint8_t c;
+	int x1, y1, x2, y2;                // Line ends, or position and size
+	int trans;
+	const void *b;                     // Bitmap or sprite
+	const uint8_t *plt;
+};
+struct rcgl_cmdlist {
+	struct CMD *cmds;                  // Grows, and is reused after running
+	int n, cap;
+	uint32_t *bins;                    // Commands per band, in order
+	int nbins;
+	int *bandend;                      // End of each band in bins
+	int nbands;
+	rcgl_context *ctx;                 // Context it's deferred to
+	rcgl_cmdlist *next;                // Next list deferred to the update
+};
+
+// Where a band is drawn, so workers needn't share or copy the context
+struct TARGET {
+	uint8_t *buf;
+	int bw, bh;                        // bw is also the pitch
+	int cx1, cy1, cx2, cy2;            // Clip rectangle, x2 and y2 exclusive
+};
+
+// Text
+static uint64_t glyphmask[256];        // Glyph row bits to 0xff/0x00 bytes
+
+static const char *stagenames[RCGL_NUMSTAGES] = {
+	"handoff", "diff", "convert", "lock", "copy", "present", "wait", "frame"
+};
 
 
 /* Internal prototypes */
-static void blit(uint8_t *src, uint32_t *dst);
+static int ctxinit(rcgl_context *ctx, int w, int h, int ww, int wh,
+                   const char *title, int wflags);
+static int lockctx(void);
+static int sharedinit(void);
+static void windowdone(void);
+static void blit(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                 int pitch, const SDL_Rect *r);
+static void scalerow(rcgl_context *ctx, const uint8_t *src, uint32_t *dst,
+                     int x, int n);
+static SDL_Rect scalerect(rcgl_context *ctx, const SDL_Rect *r);
+static void blitlayers(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                       int pitch, const SDL_Rect *r);
+static void composite(const struct LAYERS *ls, uint8_t *dst,
+                      const uint8_t *src, int x, int y, int n);
+static const uint8_t *composited(rcgl_context *ctx, const uint8_t *src,
+                                 const SDL_Rect *rects, int nrects);
+static int layered(rcgl_context *ctx);
+static void scaletables(rcgl_context *ctx, int w, int h);
+static int convert(rcgl_context *ctx, const uint8_t *src, const SDL_Rect *r);
+static int render(rcgl_context *ctx, const uint8_t *src, const uint32_t *pal,
+                  SDL_Rect *rects, int *nrects);
+static void present(rcgl_context *ctx, const SDL_Rect *rects, int nrects);
+static void diffrows(rcgl_context *ctx, const uint8_t *src, SDL_Rect *rects,
+                     int *nrects);
+static void indexrows(rcgl_context *ctx, const uint8_t *src);
+static void palanimate(rcgl_context *ctx);
+static int palkeys(rcgl_context *ctx, uint32_t *keys, int n, int first,
+                   int last, int loop);
+static struct CMD *cmdadd(rcgl_cmdlist *l, int type);
+static int cmdbounds(rcgl_context *ctx, const struct CMD *c, SDL_Rect *r);
+static void cmdbands(void);
+static void cmdband(struct TARGET *dst, const rcgl_cmdlist *l, int b, int cy1,
+                    int cy2);
+static void cmddraw(const struct TARGET *dst, const struct CMD *c);
+static void rundeferred(rcgl_context *ctx);
+static void cmdundefer(rcgl_cmdlist *l);
+static int surfaceinit(rcgl_context *ctx);
+static void surfacepal(rcgl_context *ctx);
+static void surfacefree(rcgl_context *ctx);
+static int layout(rcgl_context *ctx);
+static void refresh(rcgl_context *ctx);
+static void blitrow_c(const uint8_t *src, uint32_t *dst, int n,
+                      const uint32_t *lut);
+#ifdef RCGL_HAVE_AVX2
+static void blitrow_avx2(const uint8_t *src, uint32_t *dst, int n,
+                         const uint32_t *lut);
+#endif
 static int videothread(void *data);
+static void windowinit(rcgl_context *ctx);
+static void windowfree(rcgl_context *ctx);
+static void windowquit(rcgl_context *ctx);
+static rcgl_context *winctx(uint32_t id);
+static void redraw(rcgl_context *ctx, int async);
+static void shmpoll(rcgl_context *ctx);
+#ifdef RCGL_HAVE_SHM
+static int shmthread(void *data);
+#endif
+static void shmsleep(int32_t *v, int32_t old);
+static void shmwake(int32_t *v);
+static size_t spritesize(const rcgl_sprite *s);
+static int spritecheck(const rcgl_sprite *s, size_t datasize);
+static int pakpad(FILE *f, uint32_t *pos, uint32_t to);
+static int pakcmp(const void *a, const void *b);
+static void pblit(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                  int pitch, const SDL_Rect *r);
+static void poolbands(void);
+static int pooltake(void);
+static void poolrun(void (*job)(void));
+static int poolthread(void *data);
+static void poolresize(int n);
+static void damage(rcgl_context *ctx, int x, int y, int w, int h);
+static void damagelist(rcgl_context *ctx, SDL_Rect *list, int *n, int x, int y,
+                       int w, int h);
+static void handoffdamage(rcgl_context *ctx);
+static uint32_t nextframe(rcgl_context *ctx);
+static struct TARGET target(const rcgl_context *ctx);
+static void clipdamage(rcgl_context *ctx, int x, int y, int w, int h);
+static void line(const struct TARGET *dst, int x1, int y1, int x2, int y2,
+                 uint8_t c);
+static void arcend(int a, int64_t *ux, int64_t *uy);
+static void span(rcgl_context *ctx, int x1, int x2, int y, uint8_t c);
+static void pixel(rcgl_context *ctx, int x, int y, uint8_t c);
+static void ellipse(rcgl_context *ctx, int x, int y, int rx, int ry, uint8_t c,
+                    int fill);
+static int64_t ceildiv(int64_t a, int64_t b);
+static int edgecmp(const void *a, const void *b);
+static void fillpoly(rcgl_context *ctx, const int *xy, int n, uint8_t c);
+static void polybounds(rcgl_context *ctx, const int *xy, int n);
+static int text(rcgl_context *ctx, int x, int y, const char *str, int fg,
+                int bg);
+static void glyph(rcgl_context *ctx, const uint8_t *rows, int x, int y,
+                  uint8_t fg, uint8_t bg, int trans);
+static void input(rcgl_context *ctx, const SDL_Event *e);
+static void timed(rcgl_context *ctx, int stage, uint64_t start);
+static void applyvsync(rcgl_context *ctx, int mode);
+static int pace(uint64_t *deadline, int hz);
+static void stagetime(rcgl_context *ctx, int stage, uint64_t start,
+                      uint64_t dur);
+static void commitstats(rcgl_context *ctx);
+static int u64cmp(const void *a, const void *b);
+static void mapmouse(rcgl_context *ctx, int *x, int *y);
+static void keyrow(uint8_t *dst, const uint8_t *src, int n, uint8_t key);
+static void fliprow(uint8_t *dst, const uint8_t *src, int n, int trans,
+                    const uint8_t *plt);
+static void blitrect(const struct TARGET *dst, const uint8_t *b, int pitch,
+                     int x, int y, int w, int h, int flags, int trans,
+                     const uint8_t *plt);
+static void spritedraw(const struct TARGET *dst, const rcgl_sprite *s, int x,
+                       int y, const uint8_t *plt);
+static void maprow(uint8_t *dst, const uint8_t *src, int n,
+                   const uint8_t *plt);
+static int clipsteps(int *lo, int *hi, int a1, int sa, int ada, int alo,
+                     int ahi, int b1, int sb, int adb, int blo, int bhi);
+static void spanclip(int *lo, int *hi, int64_t a, int64_t da, int64_t max);
+static uint32_t wrapfix(int64_t a, int64_t m);
+static void texrow(uint8_t *dst, const uint8_t *b, int pitch, uint32_t u,
+                   uint32_t v, uint32_t du, uint32_t dv, int n, uint32_t ww,
+                   uint32_t wh, int trans, const uint8_t *plt);
+static void capture(rcgl_context *ctx, const uint8_t *src, const uint32_t *pal);
+static int capthread(void *data);
+static void put32(FILE *f, uint32_t v);
+static int get32(FILE *f, uint32_t *v);
+static int pngpattern(const char *out);
+static int writepng(const char *name, const uint8_t *src, uint32_t w,
+                    uint32_t h, const uint32_t *pal);
 
 
 
@@ -88,450 +567,5958 @@ static int videothread(void *data);
  * title - title
  * sc - integer pixel scale (window size is w*sc by h*sc)
  * wflags:  1 = RESIZABLE, 2 = FULLSCREEN, 4 = MAXIMIZED,
- *          8 = FULLSCREEN_NATIVE, 16 = INTEGER SCALING
+ *          8 = FULLSCREEN_NATIVE, 16 = INTEGER SCALING,
+ *          32 = DIRTY RECTANGLE UPDATES, 64 = HEADLESS
  */
 int rcgl_init(int w, int h, int ww, int wh, const char *title, int wflags)
 {
-	int rval = 0;
-	int istat;
+	memset(&defctx, 0, sizeof(defctx));
+	defctx.palette = rcgl_palette;
+	return ctxinit(&defctx, w, h, ww, wh, title, wflags);
+}
+
+/*
+ * rcgl_ctx_init - Create another window, or headless buffer, as a context
+ * Takes the same arguments as rcgl_init, its palette is its own rather than
+ * rcgl_palette. Returns NULL on error.
+ */
+rcgl_context *rcgl_ctx_init(int w, int h, int ww, int wh, const char *title,
+                            int wflags)
+{
+	rcgl_context *ctx;
 
-	bw = w;
-	bh = h;
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate context\n");
+		return NULL;
+	}
+	ctx->palette = ctx->ownpal;
+	if (ctxinit(ctx, w, h, ww, wh, title, wflags) < 0) {
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
 
-	cargs.w = w;
-	cargs.h = h;
-	cargs.ww = ww;
-	cargs.wh = wh;
-	cargs.title = title;
-	cargs.wflags = wflags;
+/*
+ * rcgl_getcontext - Get the context rcgl_init set up
+ * So the calls taking a context can be used on it too
+ */
+rcgl_context *rcgl_getcontext(void)
+{
+	return &defctx;
+}
 
-	// Create internal framebuffer
-	if ((ibuf = calloc(w*h, sizeof(uint8_t))) == NULL) {
-		fprintf(stderr, "RCGL: Failed to allocate internal framebuffer\n");
-		rval = -1;
-		goto failalloc;
+/*
+ * rcgl_ctx_palette - Get a context's palette, as rcgl_palette is for rcgl_init
+ */
+uint32_t *rcgl_ctx_palette(rcgl_context *ctx)
+{
+	return ctx->palette;
+}
+
+/*
+ * rcgl_quit - Terminate program manually
+ */
+void rcgl_quit(void)
+{
+	rcgl_ctx_quit(&defctx);
+}
+
+/*
+ * rcgl_ctx_quit - Close a context's window and free it
+ */
+void rcgl_ctx_quit(rcgl_context *ctx)
+{
+	if (ctx->capfile)
+		rcgl_ctx_capture_stop(ctx);
+	if (ctx->tracefile)
+		rcgl_ctx_trace_stop(ctx);
+	if (ctx->shm)
+		rcgl_ctx_shm_destroy(ctx);
+
+	if (ctx->headless) {
+		SDL_AtomicSet(&ctx->status, 0);
+		free(ctx->hbuf);
+		ctx->hbuf = NULL;
 	}
-	buf = ibuf;
+	else {
+		// Have the event thread close the window
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = EVENT_DESTROY;
+		event.user.data1 = ctx;
+		SDL_PushEvent(&event);
 
-	// Set default palette
-	rcgl_setpalette(RCGL_PALETTE_VGA);
+		SDL_LockMutex(ctx->mutex);
+		while (ctx->initstatus > 0)
+			SDL_CondWait(ctx->initcond, ctx->mutex);
+		SDL_UnlockMutex(ctx->mutex);
 
-	mutex = SDL_CreateMutex();
-	if (mutex == NULL) {
-		fprintf(stderr, "RCGL: Failed to create mutex\n");
-		rval = -2;
-		goto failmutex;
+		SDL_LockMutex(ctxlock);
+		windowdone();
+		SDL_UnlockMutex(ctxlock);
 	}
-	initcond = SDL_CreateCond();
-	if (initcond == NULL) {
-		fprintf(stderr, "RCGL: Failed to create init condition variable\n");
-		rval = -2;
-		goto failcond;
+
+	// Workers are stopped once nobody is left to use them
+	SDL_LockMutex(ctxlock);
+	if (--ncontexts == 0) {
+		SDL_AtomicLock(&pool.lock);
+		poolresize(0);
+		SDL_AtomicUnlock(&pool.lock);
 	}
-	waitdrawcond = SDL_CreateCond();
-	if (waitdrawcond == NULL) {
-		fprintf(stderr, "RCGL: Failed to create wdraw condition variable\n");
-		rval = -2;
-		goto failcond2;
+	SDL_UnlockMutex(ctxlock);
+
+	rcgl_ctx_palstop(ctx, -1);
+	while (ctx->deferred) {
+		rcgl_cmdlist *l = ctx->deferred;
+		ctx->deferred = l->next;
+		l->ctx = NULL;
 	}
 
-	// Create user defined events
-	EVENT_TERM = SDL_RegisterEvents(2);
-	if (EVENT_TERM == (uint32_t)-1) {
-		fprintf(stderr, "RCGL: Failed to create user events\n");
-		rval = -2;
-		goto failevent;
+	SDL_DestroyCond(ctx->waitdrawcond);
+	SDL_DestroyCond(ctx->initcond);
+	SDL_DestroyMutex(ctx->mutex);
+	ctx->waitdrawcond = ctx->initcond = NULL;
+	ctx->mutex = NULL;
+
+	// Finally destroy our buffers
+	if (ctx->ibuf)
+		free(ctx->ibuf);
+	ctx->ibuf = NULL;
+	free(ctx->shadow);
+	ctx->shadow = NULL;
+	ctx->irowsrc = NULL;
+	free(ctx->xpos);
+	ctx->xpos = ctx->ypos = NULL;
+	ctx->lastsrc = NULL;
+	free(ctx->cbuf);
+	ctx->cbuf = NULL;
+	free(ctx->edges);
+	free(ctx->active);
+	free(ctx->xcross);
+	ctx->edges = NULL;
+	ctx->active = NULL;
+	ctx->xcross = NULL;
+	ctx->nedges = 0;
+	free(ctx->fring[0]);
+	for (int i = 0; i < NFRAMES; i++)
+		ctx->fring[i] = NULL;
+	ctx->fpending = ctx->fbusy = -1;
+
+	if (ctx != &defctx)
+		free(ctx);
+}
+
+/*
+ * rcgl_ctx_update - Render buffer to screen
+ */
+int rcgl_ctx_update(rcgl_context *ctx)
+{
+	uint32_t id;
+
+	rundeferred(ctx);
+	palanimate(ctx);
+	if (ctx->capfile)
+		capture(ctx, ctx->buf, ctx->palette);
+
+	// Hand the accumulated damage over to the video thread
+	SDL_LockMutex(ctx->mutex);
+	handoffdamage(ctx);
+	ctx->ulayers = ctx->layers;
+	id = ctx->fupdateid = nextframe(ctx);
+	ctx->fpushtime = SDL_GetPerformanceCounter();
+	if (ctx->headless) {
+		if (SDL_AtomicGet(&ctx->wantvsync) == RCGL_VSYNC_FIXED)
+			pace(&ctx->pacedeadline, SDL_AtomicGet(&ctx->pacehz));
+		ctx->drawlayers = &ctx->ulayers;
+		ctx->drawstatus = render(ctx, ctx->buf, ctx->palette, ctx->udirty,
+		                         &ctx->nudirty);
+		ctx->nudirty = 0;
+		commitstats(ctx);
+		SDL_AtomicSet(&ctx->fpresented, id);
+		SDL_UnlockMutex(ctx->mutex);
+		return ctx->drawstatus;
 	}
-	EVENT_REDRAW = EVENT_TERM+1;
+	SDL_UnlockMutex(ctx->mutex);
 
-	
-	
-	// Start-up video thread
-	thread = SDL_CreateThread(videothread, "RCGLWindowThread", NULL);
-	if (thread == NULL) {
-		fprintf(stderr, "RCGL: Failed to create RCGLWindowThread: %s\n",
-		        SDL_GetError());
-		rval = -3;
-		goto failthread;
+	SDL_Event event;
+	SDL_zero(event);
+	event.type = EVENT_REDRAW;
+	event.user.data1 = ctx;
+	SDL_PushEvent(&event);
+
+	// Wait for thread to draw changes before returning
+	return rcgl_ctx_wait(ctx, id);
+}
+
+/*
+ * rcgl_ctx_submit - Queue a copy of the buffer for display without waiting
+ * Drawing can continue into the buffer straight away. Only the most recent
+ * frame is shown if the video thread falls behind, older ones are dropped.
+ * Returns the frame id to pass to rcgl_wait, or 0 on error.
+ */
+uint32_t rcgl_ctx_submit(rcgl_context *ctx)
+{
+	int slot;
+	int push;
+	uint32_t id;
+
+	// Nothing to overlap with when headless
+	if (ctx->headless) {
+		rcgl_ctx_update(ctx);
+		return ctx->fsubmitted;
 	}
 
-	// Block till video thread has been initialized, or till an error occurs
-	SDL_LockMutex(mutex);
-	while (!initstatus) {
-		SDL_CondWait(initcond, mutex);
+	rundeferred(ctx);
+	palanimate(ctx);
+	if (ctx->capfile)
+		capture(ctx, ctx->buf, ctx->palette);
+
+	// Frame ring is only allocated once asynchronous updates are used
+	if (ctx->fring[0] == NULL) {
+		ctx->fring[0] = malloc((size_t)NFRAMES * ctx->bw * ctx->bh);
+		if (ctx->fring[0] == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate frame ring\n");
+			return 0;
+		}
+		for (int i = 1; i < NFRAMES; i++)
+			ctx->fring[i] = ctx->fring[0] + (size_t)i * ctx->bw * ctx->bh;
 	}
-	istat = initstatus;
-	SDL_UnlockMutex(mutex);
-	if (istat < 0) { // Failure to init
-		fprintf(stderr, "RCGL: Error intializing in video thread\n");
-		SDL_WaitThread(thread, &rval);
-		goto failthread;
+
+	// With three frames there's always one neither pending nor being drawn.
+	// Only we set fpending, so the slot stays free once we've picked it.
+	SDL_LockMutex(ctx->mutex);
+	for (slot = 0; slot == ctx->fpending || slot == ctx->fbusy; slot++)
+		;
+	if (ctx->lastsrc == ctx->fring[slot])  // Not to redraw while refilled
+		ctx->lastsrc = NULL;
+	SDL_UnlockMutex(ctx->mutex);
+
+	memcpy(ctx->fring[slot], ctx->buf, (size_t)ctx->bw * ctx->bh);
+	memcpy(ctx->fpal[slot], ctx->palette, sizeof(ctx->fpal[slot]));
+	ctx->flayers[slot] = ctx->layers;
+
+	SDL_LockMutex(ctx->mutex);
+	handoffdamage(ctx);
+	push = ctx->fpending < 0;     // Otherwise a redraw is already on its way
+	if (push)
+		ctx->fpushtime = SDL_GetPerformanceCounter();
+	else
+		ctx->fdropped++;
+	ctx->fpending = slot;
+	id = ctx->fpendingid = nextframe(ctx);
+	SDL_UnlockMutex(ctx->mutex);
+
+	if (push) {
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = EVENT_REDRAW;
+		event.user.code = 1;
+		event.user.data1 = ctx;
+		SDL_PushEvent(&event);
 	}
-	// Otherwise video thread has been launched successfully
-	// Clear the screen
-	rcgl_update();
-	
-	return rval;
-	// Failure path
-failthread:
-failevent:
-	SDL_DestroyCond(waitdrawcond);
-failcond2:
-	SDL_DestroyCond(initcond);
-failcond:
-	SDL_DestroyMutex(mutex);
-failmutex:
-	free(ibuf);
-	ibuf = NULL;
-	buf = NULL;
-failalloc:
+	return id;
+}
+
+/*
+ * rcgl_ctx_wait - Wait till frame id from rcgl_submit has been presented
+ * A dropped frame counts as presented once a newer frame is shown.
+ */
+int rcgl_ctx_wait(rcgl_context *ctx, uint32_t id)
+{
+	int rval;
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	// The predicate is rechecked under the mutex the video thread publishes
+	// under, so neither an early broadcast nor a spurious wakeup is missed
+	SDL_LockMutex(ctx->mutex);
+	while ((int32_t)(SDL_AtomicGet(&ctx->fpresented) - id) < 0
+	       && SDL_AtomicGet(&ctx->status))
+		SDL_CondWait(ctx->waitdrawcond, ctx->mutex);
+	rval = ctx->drawstatus;
+	stagetime(ctx, RCGL_STAGE_WAIT, start, SDL_GetPerformanceCounter() - start);
+	SDL_UnlockMutex(ctx->mutex);
+
 	return rval;
 }
 
 /*
- * rcgl_quit - Terminate program manually
+ * rcgl_ctx_setbuf - Change buffer to b
+ * If b is NULL, set buffer to internal buffer
  */
-void rcgl_quit(void)
+void rcgl_ctx_setbuf(rcgl_context *ctx, uint8_t *b)
 {
-	int rval = 0;
-	// Signal to video thread to close down shop
-	SDL_Event event;
-	SDL_zero(event);
-	event.type = EVENT_TERM;
-	SDL_PushEvent(&event);
+	// The video thread forgets the old buffer, which may be freed next
+	SDL_LockMutex(ctx->mutex);
+	if (ctx->lastsrc == ctx->buf)
+		ctx->lastsrc = NULL;
+	if (b)
+		ctx->buf = b;
+	else
+		ctx->buf = ctx->ibuf;
+	SDL_UnlockMutex(ctx->mutex);
+	damage(ctx, 0, 0, ctx->bw, ctx->bh);
+}
 
-	// Wait for video thread to quit
-	SDL_WaitThread(thread, &rval);
-	
-	// Finally destroy our buffer
-	if (ibuf)
-		free(ibuf);
-	ibuf = NULL;
+/*
+ * rcgl_ctx_getbuf - Get pointer to the current buffer
+ */
+uint8_t *rcgl_ctx_getbuf(rcgl_context *ctx)
+{
+	return ctx->buf;
 }
 
 /*
- * rcgl_update - Render buffer to screen
+ * rcgl_ctx_hasquit - Test if program has quit
  */
-int rcgl_update(void)
+int rcgl_ctx_hasquit(rcgl_context *ctx)
 {
-	void *rbuf;
-	int rval = 0;
-	
+	return SDL_AtomicGet(&ctx->status) == 0;
+}
 
-	SDL_Event event;
-	SDL_zero(event);
-	event.type = EVENT_REDRAW;
-	SDL_PushEvent(&event);
+/*
+ * rcgl_ctx_pollevent - Take the oldest keyboard or mouse event
+ * Returns 1 if ev was filled in, 0 if there are no events waiting
+ */
+int rcgl_ctx_pollevent(rcgl_context *ctx, rcgl_event *ev)
+{
+	int tail = SDL_AtomicGet(&ctx->evtail);
 
-	// Wait for thread to draw changes before returning
-	SDL_LockMutex(mutex);
-	SDL_CondWait(waitdrawcond, mutex);
+	if (tail == SDL_AtomicGet(&ctx->evhead))
+		return 0;
+	*ev = ctx->evq[tail & (EVQ - 1)];
+	SDL_AtomicSet(&ctx->evtail, tail + 1);
+	return 1;
+}
+
+/*
+ * rcgl_ctx_getinput - Get the current keyboard and mouse state
+ */
+void rcgl_ctx_getinput(rcgl_context *ctx, rcgl_input *in)
+{
+	// Swap in the newest snapshot if the video thread has published one
+	if (SDL_AtomicGet(&ctx->inmid) & 4)
+		ctx->infront = SDL_AtomicSet(&ctx->inmid, ctx->infront) & 3;
+	*in = ctx->inbuf[ctx->infront];
+}
+
+/*
+ * rcgl_ctx_setvsync - Change how frames are paced
+ * RCGL_VSYNC_ON, RCGL_VSYNC_OFF or RCGL_VSYNC_ADAPTIVE, or RCGL_VSYNC_FIXED to
+ * show frames at hz a second without vsync. Takes effect from the next frame.
+ * Returns -1 if the mode isn't valid.
+ */
+int rcgl_ctx_setvsync(rcgl_context *ctx, int mode, int hz)
+{
+	if (mode < RCGL_VSYNC_ON || mode > RCGL_VSYNC_FIXED
+	    || (mode == RCGL_VSYNC_FIXED && hz <= 0))
+		return -1;
+
+	SDL_AtomicSet(&ctx->pacehz, hz);
+	SDL_AtomicSet(&ctx->wantvsync, mode);
+	return 0;
+}
+
+/*
+ * rcgl_ctx_frame_wait - Wait till it's time to start the next frame
+ * Keeps a loop running at hz frames a second, sleeping for most of the wait
+ * and only spinning for the last couple of milliseconds. Returns how many
+ * frames were missed because the caller was running late.
+ */
+int rcgl_ctx_frame_wait(rcgl_context *ctx, int hz)
+{
+	if (hz <= 0)
+		return 0;
+	if (hz != ctx->waithz) {
+		ctx->waithz = hz;
+		ctx->waitdeadline = 0;
+	}
+	return pace(&ctx->waitdeadline, hz);
+}
+
+/*
+ * rcgl_ctx_setscale - Change how the frame is scaled to fit the window
+ * aspw:asph is the shape the whole frame is shown at, eg. 4:3 for 320x200,
+ * or 0:0 for square pixels. Takes effect from the next frame. Returns -1 if
+ * the mode or aspect isn't valid.
+ */
+int rcgl_ctx_setscale(rcgl_context *ctx, int mode, int aspw, int asph)
+{
+	if (mode < RCGL_SCALE_AUTO || mode > RCGL_SCALE_SHARP
+	    || aspw < 0 || asph < 0 || (aspw == 0) != (asph == 0))
+		return -1;
+
+	SDL_LockMutex(ctx->mutex);
+	ctx->wantscale = mode;
+	ctx->wantaspw = aspw;
+	ctx->wantasph = asph;
+	ctx->relayout = 1;
+	SDL_UnlockMutex(ctx->mutex);
+	return 0;
+}
+
+/*
+ * rcgl_delay - Delay for ms milliseconds
+ */
+void rcgl_delay(uint32_t ms)
+{
+	SDL_Delay(ms);
+}
+
+/*
+ * rcgl_ticks - Return number of milliseconds since start
+ */
+uint32_t rcgl_ticks(void)
+{
+	return SDL_GetTicks();
+}
+
+/*
+ * rcgl_ctx_plot - Plot a pixel at x,y with colour c
+ */
+void rcgl_ctx_plot(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	if (x < ctx->cx1 || y < ctx->cy1 || x >= ctx->cx2 || y >= ctx->cy2)
+		return;
+	ctx->buf[y * ctx->bw + x] = c;
+	if (ctx->dirtymode)
+		damage(ctx, x, y, 1, 1);
+}
+
+/*
+ * rcgl_ctx_invalidate - Mark a region of the buffer as changed
+ * Needed for writes made directly through rcgl_getbuf() with RCGL_DIRTYRECT
+ */
+void rcgl_ctx_invalidate(rcgl_context *ctx, int x, int y, int w, int h)
+{
+	damage(ctx, x, y, w, h);
+}
+
+/*
+ * rcgl_ctx_setpalette - Copy an entire palette definition into the palette
+ */
+void rcgl_ctx_setpalette(rcgl_context *ctx, const uint32_t palette[256])
+{
+	for (int i = 0; i < 256; i++)
+		ctx->palette[i] = palette[i];
+}
+
+/*
+ * rcgl_ctx_setclip - Restrict drawing to a rectangle of the buffer
+ * If w or h is 0 or less drawing is restricted to the whole buffer again
+ */
+void rcgl_ctx_setclip(rcgl_context *ctx, int x, int y, int w, int h)
+{
+	if (w <= 0 || h <= 0) {
+		x = y = 0;
+		w = ctx->bw;
+		h = ctx->bh;
+	}
+	ctx->cx1 = (x < 0) ? 0 : x;
+	ctx->cy1 = (y < 0) ? 0 : y;
+	ctx->cx2 = (x + w > ctx->bw) ? ctx->bw : x + w;
+	ctx->cy2 = (y + h > ctx->bh) ? ctx->bh : y + h;
+	if (ctx->cx2 < ctx->cx1) ctx->cx2 = ctx->cx1;
+	if (ctx->cy2 < ctx->cy1) ctx->cy2 = ctx->cy1;
+}
+
+/*
+ * rcgl_ctx_palcycle - Rotate palette entries first to last, one step every ms
+ * A negative ms rotates the other way. Returns an id for rcgl_palstop, or -1.
+ */
+int rcgl_ctx_palcycle(rcgl_context *ctx, int first, int last, int ms)
+{
+	if (first < 0 || last > 255 || first >= last || ms == 0)
+		return -1;
+
+	for (int i = 0; i < MAXPALANIM; i++) {
+		if (ctx->palanim[i].used)
+			continue;
+		memset(&ctx->palanim[i], 0, sizeof(ctx->palanim[i]));
+		ctx->palanim[i].used = 1;
+		ctx->palanim[i].first = first;
+		ctx->palanim[i].last = last;
+		ctx->palanim[i].ms = ms;
+		ctx->palanim[i].start = SDL_GetTicks();
+		return i;
+	}
+	fprintf(stderr, "RCGL: Too many palette animations\n");
+	return -1;
+}
+
+/*
+ * rcgl_ctx_palfade - Fade palette entries first to last towards target over ms
+ * Returns an id for rcgl_palstop, or -1 on error.
+ */
+int rcgl_ctx_palfade(rcgl_context *ctx, const uint32_t target[256], int first,
+                     int last, uint32_t ms)
+{
+	uint32_t *keys;
+
+	if ((keys = malloc(2 * 257 * sizeof(uint32_t))) == NULL)
+		return -1;
+	memcpy(keys, ctx->palette, 256 * sizeof(uint32_t));
+	memcpy(keys + 256, target, 256 * sizeof(uint32_t));
+	keys[512] = 0;
+	keys[513] = ms;
+	return palkeys(ctx, keys, 2, first, last, 0);
+}
+
+/*
+ * rcgl_ctx_palkeys - Animate palette entries first to last through keyframes
+ * pals holds n palettes of 256 entries, shown at times[i] ms from now and
+ * blended in between. If loop is set it restarts after the last one.
+ * Returns an id for rcgl_palstop, or -1 on error.
+ */
+int rcgl_ctx_palkeys(rcgl_context *ctx, const uint32_t *pals,
+                     const uint32_t *times, int n, int first, int last,
+                     int loop)
+{
+	uint32_t *keys;
+
+	if (n > MAXPALKEYS) {
+		fprintf(stderr, "RCGL: Too many palette keyframes\n");
+		return -1;
+	}
+	if (n < 1 || (keys = malloc((size_t)n * 257 * sizeof(uint32_t))) == NULL)
+		return -1;
+	memcpy(keys, pals, (size_t)n * 256 * sizeof(uint32_t));
+	memcpy(keys + (size_t)n * 256, times, (size_t)n * sizeof(uint32_t));
+	return palkeys(ctx, keys, n, first, last, loop);
+}
+
+/*
+ * rcgl_ctx_palstop - Stop a palette animation, or all of them if id is -1
+ * The palette is left as it was last animated.
+ */
+void rcgl_ctx_palstop(rcgl_context *ctx, int id)
+{
+	for (int i = 0; i < MAXPALANIM; i++) {
+		if (id >= 0 && i != id)
+			continue;
+		free(ctx->palanim[i].keys);
+		ctx->palanim[i].keys = NULL;
+		ctx->palanim[i].used = 0;
+	}
+}
+
+/*
+ * rcgl_ctx_line - Draw a line between two points
+ */
+void rcgl_ctx_line(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                   uint8_t c)
+{
+	struct TARGET dst = target(ctx);
+
+	if (ctx->dirtymode)
+		damage(ctx, (x1 < x2) ? x1 : x2, (y1 < y2) ? y1 : y2,
+		       abs(x2 - x1) + 1, abs(y2 - y1) + 1);
+	line(&dst, x1, y1, x2, y2, c);
+}
+
+/*
+ * rcgl_ctx_lines - Draw a connected line through n points
+ * xy holds the points as x, y pairs
+ */
+void rcgl_ctx_lines(rcgl_context *ctx, const int *xy, int n, uint8_t c)
+{
+	struct TARGET dst = target(ctx);
+
+	if (n < 1)
+		return;
+
+	if (ctx->dirtymode) {
+		int x1 = xy[0], y1 = xy[1], x2 = xy[0], y2 = xy[1];
+		for (int i = 1; i < n; i++) {
+			if (xy[i*2] < x1) x1 = xy[i*2];
+			if (xy[i*2] > x2) x2 = xy[i*2];
+			if (xy[i*2+1] < y1) y1 = xy[i*2+1];
+			if (xy[i*2+1] > y2) y2 = xy[i*2+1];
+		}
+		damage(ctx, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+	}
+
+	if (n == 1)
+		line(&dst, xy[0], xy[1], xy[0], xy[1], c);
+	for (int i = 1; i < n; i++, xy += 2)
+		line(&dst, xy[0], xy[1], xy[2], xy[3], c);
+}
+
+/*
+ * rcgl_ctx_rect - Draw the outline of a rectangle
+ */
+void rcgl_ctx_rect(rcgl_context *ctx, int x, int y, int w, int h, uint8_t c)
+{
+	if (w <= 0 || h <= 0)
+		return;
+	if (ctx->dirtymode)
+		damage(ctx, x, y, w, h);
+
+	span(ctx, x, x + w, y, c);
+	span(ctx, x, x + w, y + h - 1, c);
+	for (int i = y + 1; i < y + h - 1; i++) {
+		pixel(ctx, x, i, c);
+		pixel(ctx, x + w - 1, i, c);
+	}
+}
+
+/*
+ * rcgl_ctx_fillrect - Fill a rectangle
+ */
+void rcgl_ctx_fillrect(rcgl_context *ctx, int x, int y, int w, int h,
+                       uint8_t c)
+{
+	int y1 = (y > ctx->cy1) ? y : ctx->cy1;
+	int y2 = (y + h < ctx->cy2) ? y + h : ctx->cy2;
+
+	if (w <= 0 || h <= 0)
+		return;
+	if (ctx->dirtymode)
+		damage(ctx, x, y, w, h);
+
+	for (int i = y1; i < y2; i++)
+		span(ctx, x, x + w, i, c);
+}
+
+/*
+ * rcgl_ctx_ellipse - Draw the outline of an ellipse centred on x,y
+ */
+void rcgl_ctx_ellipse(rcgl_context *ctx, int x, int y, int rx, int ry,
+                      uint8_t c)
+{
+	ellipse(ctx, x, y, rx, ry, c, 0);
+}
+
+/*
+ * rcgl_ctx_fillellipse - Fill an ellipse centred on x,y
+ */
+void rcgl_ctx_fillellipse(rcgl_context *ctx, int x, int y, int rx, int ry,
+                          uint8_t c)
+{
+	ellipse(ctx, x, y, rx, ry, c, 1);
+}
+
+/*
+ * rcgl_ctx_circle - Draw the outline of a circle centred on x,y
+ */
+void rcgl_ctx_circle(rcgl_context *ctx, int x, int y, int r, uint8_t c)
+{
+	ellipse(ctx, x, y, r, r, c, 0);
+}
+
+/*
+ * rcgl_ctx_fillcircle - Fill a circle centred on x,y
+ */
+void rcgl_ctx_fillcircle(rcgl_context *ctx, int x, int y, int r, uint8_t c)
+{
+	ellipse(ctx, x, y, r, r, c, 1);
+}
+
+/*
+ * rcgl_ctx_arc - Draw part of a circle centred on x,y
+ * From angle a1 round to a2 in degrees, anticlockwise from the right. A span
+ * of 360 or more draws the whole circle.
+ */
+void rcgl_ctx_arc(rcgl_context *ctx, int x, int y, int r, int a1, int a2,
+                  uint8_t c)
+{
+	int dx = 0, dy = r, p = 1 - r;
+	int64_t span = (int64_t)a2 - a1;
+	int64_t ux1, uy1, ux2, uy2;    // Towards each end, 2^30 long
+	int full;
+
+	if (r < 0)
+		return;
+	full = span >= 360 || r == 0;
+	span %= 360;
+	if (span < 0)
+		span += 360;
+	arcend(a1, &ux1, &uy1);
+	arcend(a2, &ux2, &uy2);
+	if (ctx->dirtymode)
+		damage(ctx, x - r, y - r, r * 2 + 1, r * 2 + 1);
+
+	// Midpoint circle, keeping only the points inside the angles
+	while (dx <= dy) {
+		int pts[8][2] = {
+			{ dx, dy }, { dy, dx }, { -dx, dy }, { -dy, dx },
+			{ dx, -dy }, { dy, -dx }, { -dx, -dy }, { -dy, -dx },
+		};
+
+		for (int i = 0; i < 8; i++) {
+			// Screen y is down, so flip it for anticlockwise
+			int64_t qx = pts[i][0], qy = -pts[i][1];
+			int64_t c1 = ux1 * qy - uy1 * qx;   // >= 0 past the start
+			int64_t c2 = qx * uy2 - qy * ux2;   // >= 0 short of the end
+			int in;
+
+			if (full)
+				in = 1;
+			else if (span == 0)
+				in = c1 == 0 && ux1 * qx + uy1 * qy > 0;
+			else if (span <= 180)
+				in = c1 >= 0 && c2 >= 0;
+			else
+				in = c1 >= 0 || c2 >= 0;
+			if (in)
+				pixel(ctx, x + pts[i][0], y + pts[i][1], c);
+		}
+
+		dx++;
+		if (p < 0) {
+			p += 2 * dx + 1;
+		}
+		else {
+			dy--;
+			p += 2 * (dx - dy) + 1;
+		}
+	}
+}
+
+/*
+ * arcend - Point ux,uy 2^30 long from the centre towards angle a, in degrees
+ * y is up, as the angles go anticlockwise.
+ */
+static void arcend(int a, int64_t *ux, int64_t *uy)
+{
+	double t = a % 360 * (M_PI / 180);
+
+	*ux = (int64_t)SDL_floor(SDL_cos(t) * (1 << 30) + 0.5);
+	*uy = (int64_t)SDL_floor(SDL_sin(t) * (1 << 30) + 0.5);
+}
+
+/*
+ * rcgl_ctx_triangle - Draw the outline of a triangle
+ */
+void rcgl_ctx_triangle(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                       int x3, int y3, uint8_t c)
+{
+	int xy[8] = { x1, y1, x2, y2, x3, y3, x1, y1 };
+
+	rcgl_ctx_lines(ctx, xy, 4, c);
+}
+
+/*
+ * rcgl_ctx_filltriangle - Fill a triangle
+ */
+void rcgl_ctx_filltriangle(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                           int x3, int y3, uint8_t c)
+{
+	int xy[6] = { x1, y1, x2, y2, x3, y3 };
+
+	rcgl_ctx_fillpolygon(ctx, xy, 3, c);
+}
+
+/*
+ * rcgl_ctx_polygon - Draw the outline of a polygon through n points
+ * xy holds the points as x, y pairs
+ */
+void rcgl_ctx_polygon(rcgl_context *ctx, const int *xy, int n, uint8_t c)
+{
+	struct TARGET dst = target(ctx);
+
+	if (n < 1)
+		return;
+	if (ctx->dirtymode)
+		polybounds(ctx, xy, n);
+
+	for (int i = 0; i < n - 1; i++)
+		line(&dst, xy[i*2], xy[i*2+1], xy[i*2+2], xy[i*2+3], c);
+	line(&dst, xy[n*2-2], xy[n*2-1], xy[0], xy[1], c);
+}
+
+/*
+ * rcgl_ctx_fillpolygon - Fill a polygon through n points
+ * Any shape works, with the even-odd rule for overlapping parts
+ */
+void rcgl_ctx_fillpolygon(rcgl_context *ctx, const int *xy, int n, uint8_t c)
+{
+	if (n < 3)
+		return;
+	if (ctx->dirtymode)
+		polybounds(ctx, xy, n);
+
+	fillpoly(ctx, xy, n, c);
+}
+
+/*
+ * rcgl_ctx_setfont - Set the font used by rcgl_text
+ */
+void rcgl_ctx_setfont(rcgl_context *ctx, const rcgl_font *f)
+{
+	ctx->font = f;
+}
+
+/*
+ * rcgl_ctx_text - Draw a string with the current font
+ * Colour bg of -1 leaves the background showing through. A newline moves
+ * down a line and back to x. Returns the x just past the last character.
+ */
+int rcgl_ctx_text(rcgl_context *ctx, int x, int y, const char *str, int fg,
+                  int bg)
+{
+	return text(ctx, x, y, str, fg, bg);
+}
+
+/*
+ * rcgl_ctx_texts - Draw n strings with the current font
+ */
+void rcgl_ctx_texts(rcgl_context *ctx, const rcgl_textitem *items, int n)
+{
+	for (int i = 0; i < n; i++)
+		text(ctx, items[i].x, items[i].y, items[i].str, items[i].fg,
+		     items[i].bg);
+}
+
+/*
+ * rcgl_ctx_blit - Blit a bitmap somewhere onto the framebuffer
+ */
+void rcgl_ctx_blit(rcgl_context *ctx, uint8_t *b, int x, int y, int w, int h,
+                   int trans, uint8_t *plt)
+{
+	struct TARGET dst = target(ctx);
+
+	if (ctx->dirtymode)
+		clipdamage(ctx, x, y, w, h);
+	blitrect(&dst, b, w, x, y, w, h, 0, trans, plt);
+}
+
+/*
+ * rcgl_sprite_compile - Pre-compile a colour keyed bitmap into a sprite
+ * Each row is stored as runs of opaque pixels, so drawing doesn't have to test
+ * pixels against the key. Returns NULL on error.
+ */
+rcgl_sprite *rcgl_sprite_compile(const uint8_t *b, int w, int h, int trans)
+{
+	rcgl_sprite *s;
+	size_t size = 0;
+	uint8_t *p;
+
+	if (w <= 0 || h <= 0 || w > 0xFFFF) {
+		fprintf(stderr, "RCGL: Invalid sprite size %dx%d\n", w, h);
+		return NULL;
+	}
+
+	// First pass to size the run data
+	for (int y = 0; y < h; y++) {
+		const uint8_t *r = b + y * w;
+		size += 2;
+		for (int x = 0; x < w; ) {
+			int n;
+			while (x < w && r[x] == trans)
+				x++;
+			for (n = 0; x < w && r[x] != trans; n++, x++)
+				;
+			if (n)
+				size += 4 + n;
+		}
+	}
+
+	s = malloc(sizeof(*s) + h * sizeof(uint32_t) + size);
+	if (s == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate sprite\n");
+		return NULL;
+	}
+	s->w = w;
+	s->h = h;
+	s->rows = (uint32_t *)(s + 1);
+	s->data = (uint8_t *)(s->rows + h);
+
+	// Second pass to fill it in
+	p = s->data;
+	for (int y = 0; y < h; y++) {
+		const uint8_t *r = b + y * w;
+		uint8_t *count = p;
+		int runs = 0, last = 0;
+
+		s->rows[y] = p - s->data;
+		p += 2;
+		for (int x = 0; x < w; ) {
+			int start, n;
+			while (x < w && r[x] == trans)
+				x++;
+			for (start = x, n = 0; x < w && r[x] != trans; n++, x++)
+				;
+			if (n) {
+				p[0] = start - last;
+				p[1] = (start - last) >> 8;
+				p[2] = n;
+				p[3] = n >> 8;
+				memcpy(p + 4, r + start, n);
+				p += 4 + n;
+				last = x;
+				runs++;
+			}
+		}
+		count[0] = runs;
+		count[1] = runs >> 8;
+	}
+
+	return s;
+}
+
+/*
+ * rcgl_ctx_sprite_draw - Draw a compiled sprite at x,y
+ * If plt is not NULL the pixels are passed through it as with rcgl_blit
+ */
+void rcgl_ctx_sprite_draw(rcgl_context *ctx, const rcgl_sprite *s, int x,
+                          int y, const uint8_t *plt)
+{
+	struct TARGET dst = target(ctx);
+
+	if (ctx->dirtymode)
+		clipdamage(ctx, x, y, s->w, s->h);
+	spritedraw(&dst, s, x, y, plt);
+}
+
+/*
+ * spritedraw - Draw a compiled sprite at x,y, clipped, without marking damage
+ */
+static void spritedraw(const struct TARGET *dst, const rcgl_sprite *s, int x,
+                       int y, const uint8_t *plt)
+{
+	int l, r, t, b;             // Visible part of the sprite
+
+	l = (x < dst->cx1) ? dst->cx1 - x : 0;
+	t = (y < dst->cy1) ? dst->cy1 - y : 0;
+	r = (x + s->w > dst->cx2) ? dst->cx2 - x : s->w;
+	b = (y + s->h > dst->cy2) ? dst->cy2 - y : s->h;
+	if (l >= r || t >= b)
+		return;
+
+	for (int sy = t; sy < b; sy++) {
+		const uint8_t *p = s->data + s->rows[sy];
+		uint8_t *fb = dst->buf + (y + sy) * dst->bw + x;
+		int runs = p[0] | (p[1] << 8);
+		int sx = 0;
+
+		p += 2;
+		while (runs--) {
+			int n, a, e;
+
+			sx += p[0] | (p[1] << 8);
+			n = p[2] | (p[3] << 8);
+			p += 4;
+			if (sx >= r)
+				break;
+
+			// Trim the run to the visible part
+			a = (sx < l) ? l : sx;
+			e = (sx + n > r) ? r : sx + n;
+			if (a < e) {
+				if (plt)
+					maprow(fb + a, p + (a - sx), e - a, plt);
+				else
+					memcpy(fb + a, p + (a - sx), e - a);
+			}
+			p += n;
+			sx += n;
+		}
+	}
+}
+
+/*
+ * rcgl_sprite_free - Free a compiled sprite
+ */
+void rcgl_sprite_free(rcgl_sprite *s)
+{
+	free(s);
+}
+
+/*
+ * rcgl_ctx_blit_rect - Blit the w x h area at sx,sy of a bitmap to x,y
+ * The bitmap is pitch bytes a row, so frames can be drawn straight out of a
+ * sprite sheet. flags can flip it with RCGL_FLIPX and RCGL_FLIPY, trans and
+ * plt are as with rcgl_blit.
+ */
+void rcgl_ctx_blit_rect(rcgl_context *ctx, const uint8_t *b, int pitch, int sx,
+                        int sy, int w, int h, int x, int y, int flags,
+                        int trans, const uint8_t *plt)
+{
+	struct TARGET dst = target(ctx);
+
+	if (ctx->dirtymode)
+		clipdamage(ctx, x, y, w, h);
+	blitrect(&dst, b + sy * pitch + sx, pitch, x, y, w, h, flags, trans, plt);
+}
+
+/*
+ * rcgl_atlas_create - Make a sprite sheet holding a copy of a w x h bitmap
+ * The bitmap is pitch bytes a row, or if b is NULL the sheet starts out
+ * blank to be filled in through rcgl_atlas_pixels. Frames are added with
+ * rcgl_atlas_add or rcgl_atlas_grid. Returns NULL on error.
+ */
+rcgl_atlas *rcgl_atlas_create(const uint8_t *b, int w, int h, int pitch)
+{
+	rcgl_atlas *a;
+
+	if (w <= 0 || h <= 0) {
+		fprintf(stderr, "RCGL: Invalid atlas size %dx%d\n", w, h);
+		return NULL;
+	}
+
+	a = calloc(1, sizeof(*a) + (size_t)w * h);
+	if (a == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate atlas\n");
+		return NULL;
+	}
+	a->w = w;
+	a->h = h;
+	a->pix = (uint8_t *)(a + 1);
+	if (b)
+		for (int y = 0; y < h; y++)
+			memcpy(a->pix + y * w, b + y * pitch, w);
+	return a;
+}
+
+/*
+ * rcgl_atlas_pixels - Get a sprite sheet's bitmap, a->w bytes a row
+ */
+uint8_t *rcgl_atlas_pixels(rcgl_atlas *a)
+{
+	return a->pix;
+}
+
+/*
+ * rcgl_atlas_add - Add a frame covering w x h at x,y of the sheet
+ * name may be NULL if the frame is only wanted by number. Returns the frame
+ * number, counting from 0 in the order they're added, or -1 on error.
+ */
+int rcgl_atlas_add(rcgl_atlas *a, const char *name, int x, int y, int w,
+                   int h)
+{
+	struct FRAME *f;
+
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > a->w || y + h > a->h) {
+		fprintf(stderr, "RCGL: Atlas frame %dx%d at %d,%d is outside the "
+		        "sheet\n", w, h, x, y);
+		return -1;
+	}
+
+	if (a->nframes == a->cap) {
+		int cap = a->cap ? a->cap * 2 : 16;
+		struct FRAME *nf = realloc(a->frames, cap * sizeof(*nf));
+		if (nf == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate atlas frames\n");
+			return -1;
+		}
+		a->frames = nf;
+		a->cap = cap;
+	}
+
+	f = &a->frames[a->nframes];
+	f->x = x;
+	f->y = y;
+	f->w = w;
+	f->h = h;
+	f->name = NULL;
+	if (name) {
+		if ((f->name = malloc(strlen(name) + 1)) == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate atlas frame name\n");
+			return -1;
+		}
+		strcpy(f->name, name);
+	}
+	return a->nframes++;
+}
+
+/*
+ * rcgl_atlas_grid - Cut the whole sheet into fw x fh frames
+ * Frames are added left to right then top to bottom. Returns the number of
+ * the first one, or -1 on error.
+ */
+int rcgl_atlas_grid(rcgl_atlas *a, int fw, int fh)
+{
+	int first = a->nframes;
+
+	if (fw <= 0 || fh <= 0 || fw > a->w || fh > a->h) {
+		fprintf(stderr, "RCGL: Invalid atlas grid %dx%d\n", fw, fh);
+		return -1;
+	}
+
+	for (int y = 0; y + fh <= a->h; y += fh)
+		for (int x = 0; x + fw <= a->w; x += fw)
+			if (rcgl_atlas_add(a, NULL, x, y, fw, fh) < 0)
+				return -1;
+	return first;
+}
+
+/*
+ * rcgl_atlas_find - Find a frame by name, returns its number or -1
+ */
+int rcgl_atlas_find(const rcgl_atlas *a, const char *name)
+{
+	for (int i = 0; i < a->nframes; i++)
+		if (a->frames[i].name && strcmp(a->frames[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * rcgl_ctx_atlas_draw - Draw frame number frame of a sprite sheet at x,y
+ * flags, trans and plt are as with rcgl_blit_rect.
+ */
+void rcgl_ctx_atlas_draw(rcgl_context *ctx, const rcgl_atlas *a, int frame,
+                         int x, int y, int flags, int trans,
+                         const uint8_t *plt)
+{
+	const struct FRAME *f;
+	struct TARGET dst = target(ctx);
+
+	if (frame < 0 || frame >= a->nframes)
+		return;
+	f = &a->frames[frame];
+	if (ctx->dirtymode)
+		clipdamage(ctx, x, y, f->w, f->h);
+	blitrect(&dst, a->pix + f->y * a->w + f->x, a->w, x, y, f->w, f->h,
+	         flags, trans, plt);
+}
+
+/*
+ * rcgl_atlas_free - Free a sprite sheet and its frames
+ */
+void rcgl_atlas_free(rcgl_atlas *a)
+{
+	if (a == NULL)
+		return;
+	for (int i = 0; i < a->nframes; i++)
+		free(a->frames[i].name);
+	free(a->frames);
+	free(a);
+}
+
+/*
+ * rcgl_ctx_blit_affine - Blit a w x h bitmap through a 2x3 transform
+ * m takes a point sx,sy of the bitmap to m[0]*sx + m[1]*sy + m[4],
+ * m[2]*sx + m[3]*sy + m[5] in the buffer, all 16.16 fixed point. Buffer
+ * pixels whose centres land on the bitmap are drawn, walking each row with
+ * a fixed step through the bitmap. trans and plt are as with rcgl_blit.
+ */
+void rcgl_ctx_blit_affine(rcgl_context *ctx, const uint8_t *b, int pitch,
+                          int w, int h, const int32_t m[6], int trans,
+                          const uint8_t *plt)
+{
+	const double fix = 4294967296.0;
+	double det, ia, ib, ic, id, tx, ty;
+	double x1, y1, x2, y2;
+	int64_t sw = (int64_t)w << 16, sh = (int64_t)h << 16, du, dv;
+	int l, t, r, bt;
+
+	if (w <= 0 || h <= 0 || w > 0x7FFF || h > 0x7FFF)
+		return;
+	det = (double)m[0] * m[3] - (double)m[1] * m[2];
+	if (det == 0)
+		return;
+
+	// Inverse of m, the step through the bitmap per buffer pixel in 16.16
+	ia = m[3] * fix / det;
+	ib = -(double)m[1] * fix / det;
+	ic = -(double)m[2] * fix / det;
+	id = m[0] * fix / det;
+	if (SDL_fabs(ia) > fix || SDL_fabs(ib) > fix || SDL_fabs(ic) > fix ||
+	    SDL_fabs(id) > fix)
+		return;
+	tx = m[4] / 65536.0;
+	ty = m[5] / 65536.0;
+
+	// Bounding box of the bitmap's corners in the buffer
+	x1 = x2 = tx;
+	y1 = y2 = ty;
+	for (int i = 1; i < 4; i++) {
+		double cx = (i & 1) ? w : 0, cy = (i & 2) ? h : 0;
+		double px = (m[0] * cx + m[1] * cy) / 65536.0 + tx;
+		double py = (m[2] * cx + m[3] * cy) / 65536.0 + ty;
+		if (px < x1) x1 = px;
+		if (px > x2) x2 = px;
+		if (py < y1) y1 = py;
+		if (py > y2) y2 = py;
+	}
+
+	// Pixels with centres inside it, clipped to the clip rectangle
+	x1 = SDL_ceil(x1 - 0.5);
+	y1 = SDL_ceil(y1 - 0.5);
+	x2 = SDL_floor(x2 - 0.5) + 1;
+	y2 = SDL_floor(y2 - 0.5) + 1;
+	l = (x1 > ctx->cx1) ? (int)x1 : ctx->cx1;
+	t = (y1 > ctx->cy1) ? (int)y1 : ctx->cy1;
+	r = (x2 < ctx->cx2) ? (int)x2 : ctx->cx2;
+	bt = (y2 < ctx->cy2) ? (int)y2 : ctx->cy2;
+	if (l >= r || t >= bt)
+		return;
+
+	if (ctx->dirtymode)
+		damage(ctx, l, t, r - l, bt - t);
+	if (trans > 255)
+		trans = -1;
+
+	du = (int64_t)SDL_floor(ia + 0.5);
+	dv = (int64_t)SDL_floor(ic + 0.5);
+	for (int y = t; y < bt; y++) {
+		double px = l + 0.5 - tx, py = y + 0.5 - ty;
+		int64_t u = (int64_t)SDL_floor(ia * px + ib * py + 0.5);
+		int64_t v = (int64_t)SDL_floor(ic * px + id * py + 0.5);
+		int lo = 0, hi = r - l - 1;
+
+		// Only walk the part of the row that stays on the bitmap
+		spanclip(&lo, &hi, u, du, sw);
+		spanclip(&lo, &hi, v, dv, sh);
+		if (lo <= hi)
+			texrow(ctx->buf + y * ctx->bw + l + lo, b, pitch,
+			       u + lo * du, v + lo * dv, du, dv, hi - lo + 1, 0, 0,
+			       trans, plt);
+	}
+}
+
+/*
+ * rcgl_ctx_blit_rotate - Blit a w x h bitmap centred on x,y, rotated and scaled
+ * angle is in degrees anticlockwise and scale is 16.16 fixed point, so 65536
+ * draws it at its own size.
+ */
+void rcgl_ctx_blit_rotate(rcgl_context *ctx, const uint8_t *b, int pitch,
+                          int w, int h, int x, int y, int angle,
+                          int32_t scale, int trans, const uint8_t *plt)
+{
+	double a = (angle % 360) * (M_PI / 180);
+	int32_t m[6];
+
+	m[0] = (int32_t)SDL_floor(SDL_cos(a) * scale + 0.5);
+	m[1] = (int32_t)SDL_floor(SDL_sin(a) * scale + 0.5);
+	m[2] = -m[1];
+	m[3] = m[0];
+	m[4] = (int32_t)((int64_t)x * 65536 -
+	                 ((int64_t)m[0] * w + (int64_t)m[1] * h) / 2);
+	m[5] = (int32_t)((int64_t)y * 65536 -
+	                 ((int64_t)m[2] * w + (int64_t)m[3] * h) / 2);
+	rcgl_ctx_blit_affine(ctx, b, pitch, w, h, m, trans, plt);
+}
+
+/*
+ * rcgl_ctx_blit_mode7 - Fill the clip rectangle from a bitmap a row at a time
+ * Each buffer row steps through the bitmap as given by rows, one entry per
+ * buffer row, or if rows is NULL by calling fn, which can skip the row.
+ * With RCGL_WRAP in flags the bitmap is tiled, otherwise pixels that land
+ * off it are left alone. trans and plt are as with rcgl_blit.
+ */
+void rcgl_ctx_blit_mode7(rcgl_context *ctx, const uint8_t *b, int pitch,
+                         int w, int h, const rcgl_scanline *rows,
+                         rcgl_scanfn fn, void *data, int flags, int trans,
+                         const uint8_t *plt)
+{
+	int64_t sw = (int64_t)w << 16, sh = (int64_t)h << 16;
+	int n = ctx->cx2 - ctx->cx1;
+
+	if (w <= 0 || h <= 0 || w > 0x7FFF || h > 0x7FFF || n <= 0 ||
+	    ctx->cy1 >= ctx->cy2 || (rows == NULL && fn == NULL))
+		return;
+
+	if (ctx->dirtymode)
+		damage(ctx, ctx->cx1, ctx->cy1, n, ctx->cy2 - ctx->cy1);
+	if (trans > 255)
+		trans = -1;
+
+	for (int y = ctx->cy1; y < ctx->cy2; y++) {
+		uint8_t *fb = ctx->buf + y * ctx->bw + ctx->cx1;
+		rcgl_scanline sl;
+		int64_t u, v;
+		int lo = 0, hi = n - 1;
+
+		if (rows)
+			sl = rows[y];
+		else if (!fn(data, y, &sl))
+			continue;
+
+		// Start from the left edge of the clip
+		u = sl.u + (int64_t)sl.du * ctx->cx1;
+		v = sl.v + (int64_t)sl.dv * ctx->cx1;
+		if (flags & RCGL_WRAP) {
+			texrow(fb, b, pitch, wrapfix(u, sw), wrapfix(v, sh),
+			       wrapfix(sl.du, sw), wrapfix(sl.dv, sh), n,
+			       (uint32_t)sw, (uint32_t)sh, trans, plt);
+			continue;
+		}
+
+		spanclip(&lo, &hi, u, sl.du, sw);
+		spanclip(&lo, &hi, v, sl.dv, sh);
+		if (lo <= hi)
+			texrow(fb + lo, b, pitch, u + lo * (int64_t)sl.du,
+			       v + lo * (int64_t)sl.dv, sl.du, sl.dv, hi - lo + 1,
+			       0, 0, trans, plt);
+	}
+}
+
+/*
+ * rcgl_ctx_layer_set - Put a w x h bitmap behind the buffer as layer n
+ * Layers are drawn in number order from the back, with the buffer in front
+ * of them all, and show through wherever the buffer has the index set by
+ * rcgl_layer_key. Pixels of trans let the layers further back show through,
+ * except on the backmost, which is solid. The bitmap isn't copied, and a NULL
+ * b removes the layer. Returns -1 if n or the size isn't valid.
+ */
+int rcgl_ctx_layer_set(rcgl_context *ctx, int n, const uint8_t *b, int w,
+                       int h, int trans)
+{
+	struct LAYER *l;
+
+	if (n < 0 || n >= RCGL_MAXLAYERS || (b && (w <= 0 || h <= 0)))
+		return -1;
+
+	l = &ctx->layers.l[n];
+	l->b = b;
+	l->w = w;
+	l->h = h;
+	l->sx = l->sy = 0;
+	l->trans = (trans > 255) ? -1 : trans;
+
+	ctx->layers.n = 0;
+	for (int i = 0; i < RCGL_MAXLAYERS; i++)
+		if (ctx->layers.l[i].b)
+			ctx->layers.n = i + 1;
+	damage(ctx, 0, 0, ctx->bw, ctx->bh);
+	return 0;
+}
+
+/*
+ * rcgl_ctx_layer_scroll - Show layer n from x,y at the buffer's top left
+ * The layer wraps around, so any x,y can be given. Nothing is copied, the
+ * layer is only read from there when the frame is converted.
+ */
+void rcgl_ctx_layer_scroll(rcgl_context *ctx, int n, int x, int y)
+{
+	struct LAYER *l;
+
+	if (n < 0 || n >= RCGL_MAXLAYERS || ctx->layers.l[n].b == NULL)
+		return;
+
+	l = &ctx->layers.l[n];
+	x %= l->w;
+	y %= l->h;
+	if (x < 0)
+		x += l->w;
+	if (y < 0)
+		y += l->h;
+	if (x != l->sx || y != l->sy) {
+		l->sx = x;
+		l->sy = y;
+		damage(ctx, 0, 0, ctx->bw, ctx->bh);
+	}
+}
+
+/*
+ * rcgl_ctx_layer_key - Set the buffer index that shows the layers behind
+ * 0 by default, -1 hides the layers behind a solid buffer.
+ */
+void rcgl_ctx_layer_key(rcgl_context *ctx, int trans)
+{
+	ctx->layers.key = (trans > 255) ? -1 : trans;
+	damage(ctx, 0, 0, ctx->bw, ctx->bh);
+}
+
+/*
+ * rcgl_setthreads - Set how many threads share the palette conversion
+ * 1 keeps it all on the rendering thread, which is the default, and 0 uses
+ * one thread per CPU. Returns the number of threads that will be used.
+ */
+int rcgl_setthreads(int n)
+{
+	if (n <= 0)
+		n = SDL_GetCPUCount();
+	if (n > MAXTHREADS + 1)
+		n = MAXTHREADS + 1;
+	if (n < 1)
+		n = 1;
+	SDL_AtomicSet(&wantthreads, n - 1);
+	return n;
+}
+
+/*
+ * rcgl_ctx_getpixels - Get the last rendered frame of a headless context
+ * The frame is w x h ARGB pixels with no padding between rows. Returns NULL
+ * if there is a window instead.
+ */
+const uint32_t *rcgl_ctx_getpixels(rcgl_context *ctx)
+{
+	return ctx->hbuf;
+}
+
+/*
+ * rcgl_cmd_create - Create a list to record drawing commands into
+ * Commands are run later, all those touching one band of the buffer together
+ * so it stays in cache. Returns NULL on error.
+ */
+rcgl_cmdlist *rcgl_cmd_create(void)
+{
+	rcgl_cmdlist *l = calloc(1, sizeof(*l));
+
+	if (l == NULL)
+		fprintf(stderr, "RCGL: Failed to allocate command list\n");
+	return l;
+}
+
+/*
+ * rcgl_cmd_plot - Record rcgl_plot
+ */
+void rcgl_cmd_plot(rcgl_cmdlist *l, int x, int y, uint8_t c)
+{
+	struct CMD *cmd = cmdadd(l, CMD_PLOT);
+
+	if (cmd) {
+		cmd->x1 = x;
+		cmd->y1 = y;
+		cmd->c = c;
+	}
+}
+
+/*
+ * rcgl_cmd_line - Record rcgl_line
+ */
+void rcgl_cmd_line(rcgl_cmdlist *l, int x1, int y1, int x2, int y2, uint8_t c)
+{
+	struct CMD *cmd = cmdadd(l, CMD_LINE);
+
+	if (cmd) {
+		cmd->x1 = x1;
+		cmd->y1 = y1;
+		cmd->x2 = x2;
+		cmd->y2 = y2;
+		cmd->c = c;
+	}
+}
+
+/*
+ * rcgl_cmd_blit - Record rcgl_blit
+ * b and plt are used when the list is run, so must still be valid then
+ */
+void rcgl_cmd_blit(rcgl_cmdlist *l, const uint8_t *b, int x, int y, int w,
+                   int h, int trans, const uint8_t *plt)
+{
+	struct CMD *cmd = cmdadd(l, CMD_BLIT);
+
+	if (cmd) {
+		cmd->b = b;
+		cmd->x1 = x;
+		cmd->y1 = y;
+		cmd->x2 = w;
+		cmd->y2 = h;
+		cmd->trans = trans;
+		cmd->plt = plt;
+	}
+}
+
+/*
+ * rcgl_cmd_sprite - Record rcgl_sprite_draw
+ */
+void rcgl_cmd_sprite(rcgl_cmdlist *l, const rcgl_sprite *s, int x, int y,
+                     const uint8_t *plt)
+{
+	struct CMD *cmd = cmdadd(l, CMD_SPRITE);
+
+	if (cmd) {
+		cmd->b = s;
+		cmd->x1 = x;
+		cmd->y1 = y;
+		cmd->x2 = s->w;
+		cmd->y2 = s->h;
+		cmd->plt = plt;
+	}
+}
+
+/*
+ * rcgl_ctx_cmd_run - Draw and then clear the recorded commands
+ * The result is the same as drawing them in the order they were recorded.
+ * With workers to share them, bands are drawn on several threads at once.
+ */
+void rcgl_ctx_cmd_run(rcgl_context *ctx, rcgl_cmdlist *l)
+{
+	int nb = (ctx->bh + BAND - 1) / BAND;
+	int n;
+
+	if (l->n == 0)
+		return;
+
+	// Sorting into bands only pays for itself when there are workers to
+	// share them, or the buffer is too big to stay in cache while drawing
+	if ((size_t)ctx->bw * ctx->bh < BINMIN
+	    && SDL_AtomicGet(&wantthreads) == 0) {
+		struct TARGET dst = target(ctx);
+
+		for (int i = 0; i < l->n; i++) {
+			SDL_Rect r;
+
+			if (ctx->dirtymode && cmdbounds(ctx, &l->cmds[i], &r))
+				damage(ctx, r.x, r.y, r.w, r.h);
+			cmddraw(&dst, &l->cmds[i]);
+		}
+		l->n = 0;
+		return;
+	}
+
+	if (l->nbands < nb) {
+		free(l->bandend);
+		if ((l->bandend = malloc(nb * sizeof(int))) == NULL) {
+			l->nbands = 0;
+			goto failalloc;
+		}
+		l->nbands = nb;
+	}
+	memset(l->bandend, 0, nb * sizeof(int));
+
+	// Count the commands in each band, a counting sort keeps their order.
+	// Damage is marked here once, rather than by every band drawing it.
+	n = 0;
+	for (int i = 0; i < l->n; i++) {
+		SDL_Rect r;
+
+		if (!cmdbounds(ctx, &l->cmds[i], &r))
+			continue;
+		if (ctx->dirtymode)
+			damage(ctx, r.x, r.y, r.w, r.h);
+		for (int b = r.y / BAND; b <= (r.y + r.h - 1) / BAND; b++, n++)
+			l->bandend[b]++;
+	}
+	for (int b = 1; b < nb; b++)
+		l->bandend[b] += l->bandend[b - 1];
+
+	if (l->nbins < n) {
+		free(l->bins);
+		if ((l->bins = malloc(n * sizeof(uint32_t))) == NULL) {
+			l->nbins = 0;
+			goto failalloc;
+		}
+		l->nbins = n;
+	}
+	// Filled from the back, which leaves bandend at each band's start
+	for (int i = l->n - 1; i >= 0; i--) {
+		SDL_Rect r;
+
+		if (!cmdbounds(ctx, &l->cmds[i], &r))
+			continue;
+		for (int b = r.y / BAND; b <= (r.y + r.h - 1) / BAND; b++)
+			l->bins[--l->bandend[b]] = i;
+	}
+	for (int b = 0; b < nb - 1; b++)
+		l->bandend[b] = l->bandend[b + 1];
+	l->bandend[nb - 1] = n;
+
+	// Each band's commands only draw inside it, so they can go in any order
+	if (nb > 1 && pooltake()) {
+		pool.ctx = ctx;
+		pool.cmds = l;
+		pool.bands = nb;
+		poolrun(cmdbands);
+	}
+	else {
+		struct TARGET dst = target(ctx);
+
+		for (int b = 0; b < nb; b++)
+			cmdband(&dst, l, b, ctx->cy1, ctx->cy2);
+	}
+	l->n = 0;
+	return;
+
+failalloc:
+	fprintf(stderr, "RCGL: Failed to allocate command bins\n");
+	l->n = 0;
+}
+
+/*
+ * rcgl_ctx_cmd_defer - Run the list automatically at the next update
+ */
+void rcgl_ctx_cmd_defer(rcgl_context *ctx, rcgl_cmdlist *l)
+{
+	if (l->ctx == ctx)
+		return;
+	cmdundefer(l);
+	l->ctx = ctx;
+	l->next = ctx->deferred;
+	ctx->deferred = l;
+}
+
+/*
+ * rcgl_cmd_free - Free a command list
+ */
+void rcgl_cmd_free(rcgl_cmdlist *l)
+{
+	if (l == NULL)
+		return;
+	cmdundefer(l);
+	free(l->cmds);
+	free(l->bins);
+	free(l->bandend);
+	free(l);
+}
+
+/*
+ * rcgl_ctx_stats - Get timings of the last 128 frames
+ */
+void rcgl_ctx_stats(rcgl_context *ctx, rcgl_framestats *st)
+{
+	double ms = 1000.0 / SDL_GetPerformanceFrequency();
+	uint64_t t[STATWIN];
+
+	memset(st, 0, sizeof(*st));
+	SDL_LockMutex(ctx->mutex);
+	for (int i = 0; i < RCGL_NUMSTAGES; i++) {
+		struct STAGE *sg = &ctx->stages[i];
+		uint64_t sum = 0;
+
+		if (sg->n == 0)
+			continue;
+		memcpy(t, sg->t, sg->n * sizeof(uint64_t));
+		st->stage[i].last = sg->t[(sg->next + STATWIN - 1) % STATWIN] * ms;
+		qsort(t, sg->n, sizeof(uint64_t), u64cmp);
+		for (int j = 0; j < sg->n; j++)
+			sum += t[j];
+		st->stage[i].min = t[0] * ms;
+		st->stage[i].avg = (double)sum / sg->n * ms;
+		st->stage[i].p99 = t[(sg->n * 99 + 99) / 100 - 1] * ms;
+	}
+	st->frames = ctx->fshown;
+	st->dropped = ctx->fdropped;
+	SDL_UnlockMutex(ctx->mutex);
+	st->capdropped = SDL_AtomicGet(&ctx->capdropped);
+
+	if (st->stage[RCGL_STAGE_FRAME].avg > 0)
+		st->fps = 1000.0 / st->stage[RCGL_STAGE_FRAME].avg;
+}
+
+/*
+ * rcgl_ctx_trace_start - Start recording frame timings as a Chrome trace
+ * The trace is kept in memory and written to path by rcgl_trace_stop, it can
+ * be loaded into chrome://tracing or Perfetto. Returns -1 on error.
+ */
+int rcgl_ctx_trace_start(rcgl_context *ctx, const char *path)
+{
+	FILE *f;
+
+	if (ctx->tracefile)
+		rcgl_ctx_trace_stop(ctx);
+	if ((f = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to open trace file %s\n", path);
+		return -1;
+	}
+
+	SDL_LockMutex(ctx->mutex);
+	ctx->tracefile = f;
+	ctx->tracebase = SDL_GetPerformanceCounter();
+	ctx->ntrace = 0;
+	SDL_UnlockMutex(ctx->mutex);
+	return 0;
+}
+
+/*
+ * rcgl_ctx_trace_stop - Write out and close the trace
+ * Each stage is drawn as its own track. Returns -1 if writing failed.
+ */
+int rcgl_ctx_trace_stop(rcgl_context *ctx)
+{
+	double us = 1000000.0 / SDL_GetPerformanceFrequency();
+	struct TRACEEV *ev;
+	FILE *f;
+	int n, rval = 0;
+
+	if (!ctx->tracefile)
+		return -1;
+
+	SDL_LockMutex(ctx->mutex);
+	f = ctx->tracefile;
+	ev = ctx->trace;
+	n = ctx->ntrace;
+	ctx->tracefile = NULL;
+	ctx->trace = NULL;
+	ctx->ntrace = ctx->tracecap = 0;
+	SDL_UnlockMutex(ctx->mutex);
+
+	// Name each stage's track, then all the events
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (int i = 0; i < RCGL_NUMSTAGES; i++)
+		fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		        "\"tid\":%d,\"args\":{\"name\":\"%s\"}}%s\n",
+		        i + 1, stagenames[i], (i + 1 < RCGL_NUMSTAGES || n) ? "," : "");
+	for (int i = 0; i < n; i++)
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+		        "\"ts\":%.3f,\"dur\":%.3f}%s\n",
+		        stagenames[ev[i].stage], ev[i].stage + 1,
+		        (int64_t)(ev[i].start - ctx->tracebase) * us, ev[i].dur * us,
+		        (i + 1 < n) ? "," : "");
+	fprintf(f, "]}\n");
+
+	if (ferror(f))
+		rval = -1;
+	if (fclose(f) != 0)
+		rval = -1;
+	free(ev);
+	return rval;
+}
+
+/*
+ * rcgl_ctx_capture_start - Start recording every updated frame to a file
+ * Frames are stored as palette indices, with a palette record only when the
+ * palette changes, and written out on a background thread. Any layers are
+ * composited in first. If the writer falls behind, frames are dropped rather
+ * than stalling the update, and counted in the stats.
+ */
+int rcgl_ctx_capture_start(rcgl_context *ctx, const char *path)
+{
+	if (ctx->capfile) {
+		fprintf(stderr, "RCGL: Capture already running\n");
+		return -1;
+	}
+
+	ctx->capq[0].pix = malloc((size_t)CAPFRAMES * ctx->bw * ctx->bh);
+	if (ctx->capq[0].pix == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate capture queue\n");
+		return -1;
+	}
+	for (int i = 1; i < CAPFRAMES; i++)
+		ctx->capq[i].pix = ctx->capq[0].pix + (size_t)i * ctx->bw * ctx->bh;
+
+	if ((ctx->capfile = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to open capture file %s\n", path);
+		goto failopen;
+	}
+	fwrite("RCGLCAP1", 1, 8, ctx->capfile);
+	put32(ctx->capfile, ctx->bw);
+	put32(ctx->capfile, ctx->bh);
+
+	ctx->caphead = ctx->capcount = 0;
+	ctx->capstop = ctx->caperror = 0;
+	ctx->caphaspal = 0;
+	SDL_AtomicSet(&ctx->capdropped, 0);
+
+	if ((ctx->capmutex = SDL_CreateMutex()) == NULL)
+		goto failmutex;
+	if ((ctx->capcond = SDL_CreateCond()) == NULL)
+		goto failcond;
+	ctx->capthr = SDL_CreateThread(capthread, "RCGLCaptureThread",
+	                               ctx);
+	if (ctx->capthr == NULL)
+		goto failthread;
+
+	return 0;
+	// Failure path
+failthread:
+	SDL_DestroyCond(ctx->capcond);
+failcond:
+	SDL_DestroyMutex(ctx->capmutex);
+failmutex:
+	fprintf(stderr, "RCGL: Failed to start capture thread: %s\n",
+	        SDL_GetError());
+	fclose(ctx->capfile);
+	ctx->capfile = NULL;
+failopen:
+	free(ctx->capq[0].pix);
+	ctx->capq[0].pix = NULL;
+	return -1;
+}
+
+/*
+ * rcgl_ctx_capture_stop - Finish writing queued frames and close the capture
+ * Returns -1 if any of the capture failed to write
+ */
+int rcgl_ctx_capture_stop(rcgl_context *ctx)
+{
+	int rval;
+
+	if (!ctx->capfile)
+		return -1;
+
+	SDL_LockMutex(ctx->capmutex);
+	ctx->capstop = 1;
+	SDL_CondBroadcast(ctx->capcond);
+	SDL_UnlockMutex(ctx->capmutex);
+	SDL_WaitThread(ctx->capthr, NULL);
+
+	SDL_DestroyCond(ctx->capcond);
+	SDL_DestroyMutex(ctx->capmutex);
+	rval = ctx->caperror ? -1 : 0;
+	if (fclose(ctx->capfile) != 0)
+		rval = -1;
+	ctx->capfile = NULL;
+	free(ctx->capq[0].pix);
+	ctx->capq[0].pix = NULL;
+
+	return rval;
+}
+
+/*
+ * rcgl_capture_export - Convert a capture file to another format
+ * RCGL_EXPORT_RAW - out is a single file of w x h ARGB frames, each pixel a
+ *                   little-endian 32-bit value (BGRA byte order)
+ * RCGL_EXPORT_Y4M - out is a YUV4MPEG2 4:4:4 stream at fps frames a second
+ * RCGL_EXPORT_PNG - out is a printf pattern such as "frame%05d.png" taking the
+ *                   frame number, each frame is written as an indexed PNG.
+ *                   The pattern must have exactly one %d and no other
+ *                   conversions besides %%.
+ * Returns the number of frames exported, or -1 on error.
+ */
+int rcgl_capture_export(const char *capture, const char *out, int format,
+                        int fps)
+{
+	FILE *in, *fo = NULL;
+	char magic[8];
+	uint32_t w, h, ticks;
+	uint32_t pal[256];
+	uint8_t yuv[3][256];
+	uint8_t *pix = NULL, *row = NULL;
+	int type;
+	int frames = 0;
+	int rval = -1;
+
+	if (format == RCGL_EXPORT_PNG && pngpattern(out) < 0) {
+		fprintf(stderr, "RCGL: PNG name %s needs exactly one %%d\n", out);
+		return -1;
+	}
+	if ((in = fopen(capture, "rb")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to open capture file %s\n", capture);
+		return -1;
+	}
+	if (fread(magic, 1, 8, in) != 8 || memcmp(magic, "RCGLCAP1", 8) != 0
+	    || get32(in, &w) || get32(in, &h) || w == 0 || h == 0
+	    || w > 65536 || h > 65536) {
+		fprintf(stderr, "RCGL: %s is not a capture file\n", capture);
+		goto failread;
+	}
+
+	if ((pix = malloc((size_t)w * h)) == NULL
+	    || (row = malloc((size_t)w * 4)) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate export buffers\n");
+		goto failread;
+	}
+
+	if (format != RCGL_EXPORT_PNG) {
+		if ((fo = fopen(out, "wb")) == NULL) {
+			fprintf(stderr, "RCGL: Failed to open %s\n", out);
+			goto failread;
+		}
+		if (format == RCGL_EXPORT_Y4M)
+			fprintf(fo, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C444\n",
+			        w, h, fps > 0 ? fps : 60);
+	}
+
+	memcpy(pal, RCGL_PALETTE_VGA, sizeof(pal));
+	while ((type = fgetc(in)) != EOF) {
+		if (type == 'P') {
+			for (int i = 0; i < 256; i++)
+				if (get32(in, &pal[i]))
+					goto failread;
+			continue;
+		}
+		if (type != 'F' || get32(in, &ticks)
+		    || fread(pix, 1, (size_t)w * h, in) != (size_t)w * h)
+			goto failread;
+
+		if (format == RCGL_EXPORT_PNG) {
+			char name[4096];
+			snprintf(name, sizeof(name), out, frames);
+			if (writepng(name, pix, w, h, pal) < 0)
+				goto failread;
+		}
+		else if (format == RCGL_EXPORT_Y4M) {
+			// BT.601 studio range, looked up per palette entry
+			for (int i = 0; i < 256; i++) {
+				int r = (pal[i] >> 16) & 0xFF;
+				int g = (pal[i] >> 8) & 0xFF;
+				int b = pal[i] & 0xFF;
+				yuv[0][i] = 16 + ((66*r + 129*g + 25*b + 128) >> 8);
+				yuv[1][i] = 128 + ((-38*r - 74*g + 112*b + 128) >> 8);
+				yuv[2][i] = 128 + ((112*r - 94*g - 18*b + 128) >> 8);
+			}
+			fputs("FRAME\n", fo);
+			for (int p = 0; p < 3; p++) {
+				for (uint32_t y = 0; y < h; y++) {
+					for (uint32_t x = 0; x < w; x++)
+						row[x] = yuv[p][pix[y * w + x]];
+					fwrite(row, 1, w, fo);
+				}
+			}
+		}
+		else {
+			for (uint32_t y = 0; y < h; y++) {
+				for (uint32_t x = 0; x < w; x++) {
+					uint32_t c = pal[pix[y * w + x]] | 0xFF000000;
+					row[x*4+0] = c;
+					row[x*4+1] = c >> 8;
+					row[x*4+2] = c >> 16;
+					row[x*4+3] = c >> 24;
+				}
+				fwrite(row, 4, w, fo);
+			}
+		}
+		frames++;
+	}
+	rval = frames;
+
+failread:
+	if (rval < 0)
+		fprintf(stderr, "RCGL: Failed exporting capture %s\n", capture);
+	if (fo && fclose(fo) != 0)
+		rval = -1;
+	free(row);
+	free(pix);
+	fclose(in);
+	return rval;
+}
+
+/*
+ * rcgl_ctx_shm_create - Move the buffer and palette into shared memory
+ * Creates the POSIX shared memory region name, such as "/rcgl-display", for
+ * other processes to open with rcgl_shm_attach and draw straight into. The
+ * region's buffer is set as if by rcgl_setbuf, and its palette replaces the
+ * context's. The video thread shows each frame posted to it with
+ * rcgl_shm_post, no rcgl_update needed. Fails if name already exists.
+ * Returns the region, or NULL on error.
+ */
+rcgl_shm *rcgl_ctx_shm_create(rcgl_context *ctx, const char *name)
+{
+#ifdef RCGL_HAVE_SHM
+	rcgl_shm *s;
+	size_t off = SHMBUFOFF;
+	size_t size = off + (size_t)ctx->bw * ctx->bh;
+	int fd;
+
+	if (ctx->shm) {
+		fprintf(stderr, "RCGL: Context already has a shared framebuffer\n");
+		return NULL;
+	}
+
+	// Never take over a region someone else made, it's only ours to remove
+	// if this call created it
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		fprintf(stderr, "RCGL: Shared memory %s already exists, in use or "
+		        "left by a display that crashed\n", name);
+		return NULL;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "RCGL: Failed to create shared memory %s\n", name);
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		fprintf(stderr, "RCGL: Failed to size shared memory %s\n", name);
+		goto failsize;
+	}
+	s = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (s == MAP_FAILED) {
+		fprintf(stderr, "RCGL: Failed to map shared memory %s\n", name);
+		goto failsize;
+	}
+	if ((ctx->shmname = malloc(strlen(name) + 1)) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate shared memory name\n");
+		goto failname;
+	}
+	strcpy(ctx->shmname, name);
+	close(fd);
+	ctx->shmsize = size;
+
+	// Carries on from the current frame
+	s->size = size;
+	s->w = ctx->bw;
+	s->h = ctx->bh;
+	s->bufoff = off;
+	SDL_AtomicSet(SHMATOM(s->seq), 0);
+	SDL_AtomicSet(SHMATOM(s->dirty), 0);
+	SDL_AtomicSet(SHMATOM(s->shown), 0);
+	memcpy(s->palette, ctx->palette, sizeof(s->palette));
+	memcpy((uint8_t *)s + off, ctx->buf, (size_t)ctx->bw * ctx->bh);
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(SHMATOM(s->magic), RCGL_SHM_MAGIC);
+
+	ctx->shm = s;
+	ctx->shmoldpal = ctx->palette;
+	ctx->palette = s->palette;
+	rcgl_ctx_setbuf(ctx, (uint8_t *)s + off);
+
+	// A thread of its own sleeps till frames are posted, and hands them to
+	// the video thread as events
+	if (!ctx->headless) {
+		SDL_LockMutex(ctx->mutex);
+		ctx->shmwatch = s;
+		SDL_UnlockMutex(ctx->mutex);
+		SDL_AtomicSet(&ctx->shmstop, 0);
+		SDL_AtomicSet(&ctx->shmqueued, 0);
+		ctx->shmthread = SDL_CreateThread(shmthread, "RCGLShmThread", ctx);
+		if (ctx->shmthread == NULL) {
+			fprintf(stderr, "RCGL: Failed to create RCGLShmThread: %s\n",
+			        SDL_GetError());
+			rcgl_ctx_shm_destroy(ctx);
+			return NULL;
+		}
+	}
+	return s;
+
+	// Failure path
+failname:
+	munmap(s, size);
+failsize:
+	close(fd);
+	shm_unlink(name);
+	return NULL;
+#else
+	(void)ctx;
+	fprintf(stderr, "RCGL: No shared memory for %s on this platform\n", name);
+	return NULL;
+#endif
+}
+
+/*
+ * rcgl_ctx_shm_destroy - Go back to the context's own buffer and palette
+ * The last shared frame and palette are kept. Attached writers see magic
+ * cleared, and the region goes once they've all detached.
+ */
+void rcgl_ctx_shm_destroy(rcgl_context *ctx)
+{
+#ifdef RCGL_HAVE_SHM
+	rcgl_shm *s = ctx->shm;
+	uint8_t *sbuf;
+
+	if (s == NULL)
+		return;
+	sbuf = (uint8_t *)s + SHMBUFOFF;
+	SDL_AtomicSet(SHMATOM(s->magic), 0);
+	shmwake(&s->shown);
+
+	// Nothing more can be drawn from the region once the video thread
+	// isn't in the middle of it
+	if (ctx->shmthread) {
+		SDL_AtomicSet(&ctx->shmstop, 1);
+		shmwake(&s->seq);
+		SDL_WaitThread(ctx->shmthread, NULL);
+		ctx->shmthread = NULL;
+	}
+	if (!ctx->headless) {
+		SDL_LockMutex(ctx->mutex);
+		ctx->shmwatch = NULL;
+		while (ctx->shmbusy)
+			SDL_CondWait(ctx->waitdrawcond, ctx->mutex);
+		if (ctx->lastsrc == sbuf)
+			ctx->lastsrc = NULL;
+		SDL_UnlockMutex(ctx->mutex);
+	}
+
+	memcpy(ctx->shmoldpal, s->palette, sizeof(s->palette));
+	ctx->palette = ctx->shmoldpal;
+	if (ctx->buf == sbuf) {
+		memcpy(ctx->ibuf, sbuf, (size_t)ctx->bw * ctx->bh);
+		rcgl_ctx_setbuf(ctx, NULL);
+	}
+
+	munmap(s, ctx->shmsize);
+	shm_unlink(ctx->shmname);
+	free(ctx->shmname);
+	ctx->shmname = NULL;
+	ctx->shm = NULL;
+
+	// Window events have nothing to redraw from till the window has been
+	// drawn from the context's own buffer again
+	if (!ctx->headless) {
+		SDL_Event event;
+		uint32_t id;
+
+		SDL_LockMutex(ctx->mutex);
+		handoffdamage(ctx);
+		ctx->ulayers = ctx->layers;
+		id = ctx->fupdateid = nextframe(ctx);
+		ctx->fpushtime = SDL_GetPerformanceCounter();
+		SDL_UnlockMutex(ctx->mutex);
+
+		SDL_zero(event);
+		event.type = EVENT_REDRAW;
+		event.user.data1 = ctx;
+		SDL_PushEvent(&event);
+		rcgl_ctx_wait(ctx, id);
+	}
+#else
+	(void)ctx;
+#endif
+}
+
+/*
+ * rcgl_shm_attach - Open the shared framebuffer name to draw into
+ * For a process other than the display's. Draw into rcgl_shm_buf and the
+ * header's palette, then call rcgl_shm_post once the frame is complete.
+ * Returns NULL on error.
+ */
+rcgl_shm *rcgl_shm_attach(const char *name)
+{
+#ifdef RCGL_HAVE_SHM
+	rcgl_shm *s;
+	struct SHMMAP *m;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		fprintf(stderr, "RCGL: Failed to open shared memory %s\n", name);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(rcgl_shm)) {
+		fprintf(stderr, "RCGL: Shared memory %s is too small\n", name);
+		close(fd);
+		return NULL;
+	}
+	s = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED) {
+		fprintf(stderr, "RCGL: Failed to map shared memory %s\n", name);
+		return NULL;
+	}
+
+	// Trust nothing in the header that isn't consistent with the region
+	if ((uint32_t)SDL_AtomicGet(SHMATOM(s->magic)) != RCGL_SHM_MAGIC
+	    || s->size != (uint32_t)st.st_size || s->w <= 0 || s->h <= 0
+	    || s->bufoff != SHMBUFOFF
+	    || s->bufoff + (uint64_t)s->w * s->h > s->size) {
+		fprintf(stderr, "RCGL: %s isn't an open shared framebuffer\n", name);
+		munmap(s, st.st_size);
+		return NULL;
+	}
+	if ((m = malloc(sizeof(*m))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate shared memory mapping\n");
+		munmap(s, st.st_size);
+		return NULL;
+	}
+	m->s = s;
+	m->size = st.st_size;
+	SDL_AtomicLock(&shmmaplock);
+	m->next = shmmaps;
+	shmmaps = m;
+	SDL_AtomicUnlock(&shmmaplock);
+	SDL_MemoryBarrierAcquire();
+	return s;
+#else
+	fprintf(stderr, "RCGL: No shared memory for %s on this platform\n", name);
+	return NULL;
+#endif
+}
+
+/*
+ * rcgl_shm_buf - Get a shared framebuffer's buffer, s->w bytes a row
+ */
+uint8_t *rcgl_shm_buf(rcgl_shm *s)
+{
+	return (uint8_t *)s + SHMBUFOFF;
+}
+
+/*
+ * rcgl_shm_post - Hand the frame drawn into a shared framebuffer to the display
+ * Returns the frame's sequence number, to pass to rcgl_shm_wait.
+ */
+int32_t rcgl_shm_post(rcgl_shm *s)
+{
+	int32_t seq;
+
+	// Frame has to be visible before the counter says it's there
+	SDL_MemoryBarrierRelease();
+	seq = SDL_AtomicAdd(SHMATOM(s->seq), 1) + 1;
+	SDL_AtomicSet(SHMATOM(s->dirty), 1);
+	shmwake(&s->seq);
+	return seq;
+}
+
+/*
+ * rcgl_shm_wait - Wait till the display has shown frame seq
+ * Drawing the next frame after this can't tear the last. Returns -1 if the
+ * display has closed the framebuffer.
+ */
+int rcgl_shm_wait(rcgl_shm *s, int32_t seq)
+{
+	int32_t shown;
+
+	while ((int32_t)((uint32_t)(shown = SDL_AtomicGet(SHMATOM(s->shown)))
+	                 - (uint32_t)seq) < 0) {
+		if ((uint32_t)SDL_AtomicGet(SHMATOM(s->magic)) != RCGL_SHM_MAGIC)
+			return -1;
+		shmsleep(&s->shown, shown);
+	}
+	return 0;
+}
+
+/*
+ * rcgl_shm_detach - Unmap a shared framebuffer from rcgl_shm_attach
+ */
+void rcgl_shm_detach(rcgl_shm *s)
+{
+#ifdef RCGL_HAVE_SHM
+	struct SHMMAP **p, *m = NULL;
+
+	SDL_AtomicLock(&shmmaplock);
+	for (p = &shmmaps; *p; p = &(*p)->next)
+		if ((*p)->s == s) {
+			m = *p;
+			*p = m->next;
+			break;
+		}
+	SDL_AtomicUnlock(&shmmaplock);
+	if (m) {
+		munmap(s, m->size);
+		free(m);
+	}
+#else
+	(void)s;
+#endif
+}
+
+/*
+ * rcgl_pak_write - Pack n palettes and bitmaps into an asset pack at path
+ * Bitmaps with a key colour also have their runs packed, so rcgl_pak_sprite
+ * can draw them without compiling. Returns 0, or -1 on error.
+ */
+int rcgl_pak_write(const char *path, const rcgl_pakitem *items, int n)
+{
+	struct PAKHEAD head;
+	struct PAKENTRY *ents;
+	const struct PAKENTRY **order;
+	uint32_t *byname;
+	rcgl_sprite **spr;
+	FILE *f = NULL;
+	uint64_t off;
+	uint32_t pos = 0;
+	int rval = -1;
+
+	if (n < 0 || n > 0xFFFFFF) {
+		fprintf(stderr, "RCGL: Invalid asset count %d\n", n);
+		return -1;
+	}
+	ents = calloc(n ? n : 1, sizeof(*ents));
+	order = calloc(n ? n : 1, sizeof(*order));
+	byname = calloc(n ? n : 1, sizeof(*byname));
+	spr = calloc(n ? n : 1, sizeof(*spr));
+	if (ents == NULL || order == NULL || byname == NULL || spr == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate asset directory\n");
+		goto failalloc;
+	}
+
+	// Lay everything out after the directory, compiling sprites on the way
+	off = sizeof(head) + (uint64_t)n * (sizeof(*ents) + sizeof(*byname));
+	for (int i = 0; i < n; i++) {
+		const rcgl_pakitem *it = &items[i];
+		struct PAKENTRY *e = &ents[i];
+
+		off = (off + PAKALIGN - 1) & ~(uint64_t)(PAKALIGN - 1);
+		if (it->name == NULL || strlen(it->name) >= sizeof(e->name)) {
+			fprintf(stderr, "RCGL: Asset %d needs a name under %d "
+			        "characters\n", i, (int)sizeof(e->name));
+			goto failitem;
+		}
+		strcpy(e->name, it->name);
+		e->type = it->type;
+		e->trans = -1;
+		e->off = (uint32_t)off;
+
+		if (it->type == RCGL_PAK_PALETTE) {
+			off += 256 * sizeof(uint32_t);
+		}
+		else if (it->type == RCGL_PAK_BITMAP) {
+			if (it->w <= 0 || it->h <= 0 || it->w > 0xFFFF
+			    || it->h > 0xFFFF) {
+				fprintf(stderr, "RCGL: Invalid size %dx%d for asset %s\n",
+				        it->w, it->h, it->name);
+				goto failitem;
+			}
+			e->w = it->w;
+			e->h = it->h;
+			off += (uint64_t)it->w * it->h;
+			if (it->trans >= 0 && it->trans <= 255) {
+				spr[i] = rcgl_sprite_compile(it->data, it->w, it->h,
+				                             it->trans);
+				if (spr[i] == NULL)
+					goto failitem;
+				off = (off + PAKALIGN - 1) & ~(uint64_t)(PAKALIGN - 1);
+				e->trans = it->trans;
+				e->runoff = (uint32_t)off;
+				e->runsize = it->h * sizeof(uint32_t) + spritesize(spr[i]);
+				off += e->runsize;
+			}
+		}
+		else {
+			fprintf(stderr, "RCGL: Unknown type %d for asset %s\n",
+			        it->type, it->name);
+			goto failitem;
+		}
+		if (off > UINT32_MAX) {
+			fprintf(stderr, "RCGL: Asset pack %s would be too large\n", path);
+			goto failitem;
+		}
+	}
+
+	// Names are looked up by bisecting the sorted order
+	for (int i = 0; i < n; i++)
+		order[i] = &ents[i];
+	qsort(order, n, sizeof(*order), pakcmp);
+	for (int i = 0; i < n; i++) {
+		if (i > 0 && strcmp(order[i-1]->name, order[i]->name) == 0) {
+			fprintf(stderr, "RCGL: Asset %s is in the pack twice\n",
+			        order[i]->name);
+			goto failitem;
+		}
+		byname[i] = order[i] - ents;
+	}
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, PAKMAGIC, sizeof(PAKMAGIC));
+	head.version = 1;
+	head.order = PAKORDER;
+	head.count = n;
+	head.size = (uint32_t)off;
+
+	if ((f = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to open asset pack %s\n", path);
+		goto failitem;
+	}
+	if (fwrite(&head, sizeof(head), 1, f) != 1
+	    || (n && fwrite(ents, sizeof(*ents), n, f) != (size_t)n)
+	    || (n && fwrite(byname, sizeof(*byname), n, f) != (size_t)n))
+		goto failwrite;
+	pos = sizeof(head) + n * (sizeof(*ents) + sizeof(*byname));
+	for (int i = 0; i < n; i++) {
+		const struct PAKENTRY *e = &ents[i];
+		size_t size = (e->type == RCGL_PAK_PALETTE)
+		              ? 256 * sizeof(uint32_t) : (size_t)e->w * e->h;
+
+		if (pakpad(f, &pos, e->off) < 0
+		    || fwrite(items[i].data, size, 1, f) != 1)
+			goto failwrite;
+		pos += size;
+		if (spr[i] == NULL)
+			continue;
+		if (pakpad(f, &pos, e->runoff) < 0
+		    || fwrite(spr[i]->rows, sizeof(uint32_t), e->h, f)
+		       != (size_t)e->h
+		    || fwrite(spr[i]->data, e->runsize - e->h * sizeof(uint32_t),
+		              1, f) != 1)
+			goto failwrite;
+		pos += e->runsize;
+	}
+	if (fclose(f) == 0)
+		rval = 0;
+	else
+		fprintf(stderr, "RCGL: Failed writing asset pack %s\n", path);
+	f = NULL;
+
+	// Failure path
+failwrite:
+	if (f) {
+		fprintf(stderr, "RCGL: Failed writing asset pack %s\n", path);
+		fclose(f);
+	}
+failitem:
+	for (int i = 0; i < n; i++)
+		rcgl_sprite_free(spr[i]);
+failalloc:
+	free(spr);
+	free(byname);
+	free(order);
+	free(ents);
+	return rval;
+}
+
+/*
+ * rcgl_pak_open - Open an asset pack written by rcgl_pak_write
+ * The file is mapped, not read, so opening costs the same however much is
+ * in it and the pages are shared with every process using the pack. Only
+ * the directory is checked. Returns NULL on error.
+ */
+rcgl_pak *rcgl_pak_open(const char *path)
+{
+	const struct PAKHEAD *head;
+	rcgl_pak *p;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate asset pack\n");
+		return NULL;
+	}
+
+#ifdef RCGL_HAVE_MMAP
+	{
+		struct stat st;
+		int fd;
+
+		if ((fd = open(path, O_RDONLY)) < 0) {
+			fprintf(stderr, "RCGL: Failed to open asset pack %s\n", path);
+			goto failopen;
+		}
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*head)) {
+			fprintf(stderr, "RCGL: Asset pack %s is too small\n", path);
+			close(fd);
+			goto failopen;
+		}
+		p->size = st.st_size;
+		p->map = mmap(NULL, p->size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p->map == MAP_FAILED) {
+			fprintf(stderr, "RCGL: Failed to map asset pack %s\n", path);
+			p->map = NULL;
+			goto failopen;
+		}
+	}
+#else
+	{
+		FILE *f;
+		long size;
+
+		if ((f = fopen(path, "rb")) == NULL) {
+			fprintf(stderr, "RCGL: Failed to open asset pack %s\n", path);
+			goto failopen;
+		}
+		if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0
+		    || (size_t)size < sizeof(*head) || fseek(f, 0, SEEK_SET) < 0
+		    || (p->map = malloc(size)) == NULL
+		    || fread(p->map, size, 1, f) != 1) {
+			fprintf(stderr, "RCGL: Failed to read asset pack %s\n", path);
+			fclose(f);
+			free(p->map);
+			p->map = NULL;
+			goto failopen;
+		}
+		fclose(f);
+		p->size = size;
+	}
+#endif
+
+	head = (const struct PAKHEAD *)p->map;
+	if (memcmp(head->magic, PAKMAGIC, sizeof(PAKMAGIC)) != 0
+	    || head->version != 1 || head->order != PAKORDER
+	    || head->size != p->size
+	    || head->count > (p->size - sizeof(*head))
+	                     / (sizeof(*p->ents) + sizeof(*p->byname))) {
+		fprintf(stderr, "RCGL: %s isn't an asset pack for this machine\n",
+		        path);
+		goto failhead;
+	}
+	p->ents = (const struct PAKENTRY *)(head + 1);
+	p->byname = (const uint32_t *)(p->ents + head->count);
+	p->count = head->count;
+
+	// Everything handed out has to lie within the file
+	for (int i = 0; i < p->count; i++) {
+		const struct PAKENTRY *e = &p->ents[i];
+		uint64_t end;
+
+		if (memchr(e->name, 0, sizeof(e->name)) == NULL
+		    || e->off % PAKALIGN != 0 || p->byname[i] >= head->count)
+			goto failentry;
+		if (e->type == RCGL_PAK_PALETTE)
+			end = (uint64_t)e->off + 256 * sizeof(uint32_t);
+		else if (e->type == RCGL_PAK_BITMAP && e->w > 0 && e->h > 0)
+			end = (uint64_t)e->off + (uint64_t)e->w * e->h;
+		else
+			goto failentry;
+		if (end > p->size)
+			goto failentry;
+		if (e->type == RCGL_PAK_BITMAP && e->runoff
+		    && (e->runoff % PAKALIGN != 0
+		        || e->runsize < e->h * sizeof(uint32_t)
+		        || (uint64_t)e->runoff + e->runsize > p->size))
+			goto failentry;
+	}
+	return p;
+
+	// Failure path
+failentry:
+	fprintf(stderr, "RCGL: Asset pack %s is damaged\n", path);
+failhead:
+#ifdef RCGL_HAVE_MMAP
+	munmap(p->map, p->size);
+#else
+	free(p->map);
+#endif
+failopen:
+	free(p);
+	return NULL;
+}
+
+/*
+ * rcgl_pak_count - Number of assets in a pack
+ */
+int rcgl_pak_count(const rcgl_pak *p)
+{
+	return p->count;
+}
+
+/*
+ * rcgl_pak_find - Find an asset by name, returns its number or -1
+ */
+int rcgl_pak_find(const rcgl_pak *p, const char *name)
+{
+	int lo = 0, hi = p->count - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int c = strcmp(name, p->ents[p->byname[mid]].name);
+
+		if (c == 0)
+			return p->byname[mid];
+		if (c < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+/*
+ * rcgl_pak_name - Name of asset number i, or NULL
+ */
+const char *rcgl_pak_name(const rcgl_pak *p, int i)
+{
+	if (i < 0 || i >= p->count)
+		return NULL;
+	return p->ents[i].name;
+}
+
+/*
+ * rcgl_pak_palette - Palette number i of a pack, or NULL if it isn't one
+ * For rcgl_setpalette, it points into the pack.
+ */
+const uint32_t *rcgl_pak_palette(const rcgl_pak *p, int i)
+{
+	if (i < 0 || i >= p->count || p->ents[i].type != RCGL_PAK_PALETTE)
+		return NULL;
+	return (const uint32_t *)(p->map + p->ents[i].off);
+}
+
+/*
+ * rcgl_pak_bitmap - Pixels of bitmap number i of a pack, or NULL
+ * Its size goes in w and h unless they're NULL. Points into the pack.
+ */
+const uint8_t *rcgl_pak_bitmap(const rcgl_pak *p, int i, int *w, int *h)
+{
+	if (i < 0 || i >= p->count || p->ents[i].type != RCGL_PAK_BITMAP)
+		return NULL;
+	if (w)
+		*w = p->ents[i].w;
+	if (h)
+		*h = p->ents[i].h;
+	return p->map + p->ents[i].off;
+}
+
+/*
+ * rcgl_pak_sprite - Bitmap number i of a pack as a compiled sprite
+ * Only for bitmaps packed with a key colour. The sprite draws straight out
+ * of the pack and is freed with it, not by rcgl_sprite_free. Returns NULL
+ * on error.
+ */
+const rcgl_sprite *rcgl_pak_sprite(rcgl_pak *p, int i)
+{
+	const struct PAKENTRY *e;
+	rcgl_sprite *s;
+	size_t datasize;
+
+	if (i < 0 || i >= p->count || p->ents[i].type != RCGL_PAK_BITMAP
+	    || p->ents[i].runoff == 0)
+		return NULL;
+	e = &p->ents[i];
+
+	if (p->sprites == NULL) {
+		p->sprites = calloc(p->count, sizeof(*p->sprites));
+		if (p->sprites == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate pack sprites\n");
+			return NULL;
+		}
+	}
+	s = &p->sprites[i];
+	if (s->w)
+		return s;
+
+	// Every run has to lie inside the pack's run data and the sprite
+	s->rows = (uint32_t *)(p->map + e->runoff);
+	s->data = (uint8_t *)(s->rows + e->h);
+	datasize = e->runsize - e->h * sizeof(uint32_t);
+	s->h = e->h;
+	s->w = e->w;
+	if (spritecheck(s, datasize) < 0) {
+		fprintf(stderr, "RCGL: Sprite %s in asset pack is damaged\n",
+		        e->name);
+		s->w = 0;
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * rcgl_pak_close - Close an asset pack
+ * Nothing it handed out may be used afterwards.
+ */
+void rcgl_pak_close(rcgl_pak *p)
+{
+	if (p == NULL)
+		return;
+#ifdef RCGL_HAVE_MMAP
+	munmap(p->map, p->size);
+#else
+	free(p->map);
+#endif
+	free(p->sprites);
+	free(p);
+}
+
+
+/*
+ * Calls without a context, working on the one rcgl_init set up
+ */
+
+int rcgl_update(void)
+{
+	return rcgl_ctx_update(&defctx);
+}
+
+uint32_t rcgl_submit(void)
+{
+	return rcgl_ctx_submit(&defctx);
+}
+
+int rcgl_wait(uint32_t id)
+{
+	return rcgl_ctx_wait(&defctx, id);
+}
+
+void rcgl_setbuf(uint8_t *b)
+{
+	rcgl_ctx_setbuf(&defctx, b);
+}
+
+uint8_t *rcgl_getbuf(void)
+{
+	return rcgl_ctx_getbuf(&defctx);
+}
+
+const uint32_t *rcgl_getpixels(void)
+{
+	return rcgl_ctx_getpixels(&defctx);
+}
+
+int rcgl_hasquit(void)
+{
+	return rcgl_ctx_hasquit(&defctx);
+}
+
+int rcgl_pollevent(rcgl_event *ev)
+{
+	return rcgl_ctx_pollevent(&defctx, ev);
+}
+
+void rcgl_getinput(rcgl_input *in)
+{
+	rcgl_ctx_getinput(&defctx, in);
+}
+
+int rcgl_setvsync(int mode, int hz)
+{
+	return rcgl_ctx_setvsync(&defctx, mode, hz);
+}
+
+int rcgl_frame_wait(int hz)
+{
+	return rcgl_ctx_frame_wait(&defctx, hz);
+}
+
+int rcgl_setscale(int mode, int aspw, int asph)
+{
+	return rcgl_ctx_setscale(&defctx, mode, aspw, asph);
+}
+
+void rcgl_plot(int x, int y, uint8_t c)
+{
+	rcgl_ctx_plot(&defctx, x, y, c);
+}
+
+void rcgl_invalidate(int x, int y, int w, int h)
+{
+	rcgl_ctx_invalidate(&defctx, x, y, w, h);
+}
+
+void rcgl_setpalette(const uint32_t palette[256])
+{
+	rcgl_ctx_setpalette(&defctx, palette);
+}
+
+int rcgl_palcycle(int first, int last, int ms)
+{
+	return rcgl_ctx_palcycle(&defctx, first, last, ms);
+}
+
+int rcgl_palfade(const uint32_t target[256], int first, int last, uint32_t ms)
+{
+	return rcgl_ctx_palfade(&defctx, target, first, last, ms);
+}
+
+int rcgl_palkeys(const uint32_t *pals, const uint32_t *times, int n,
+                 int first, int last, int loop)
+{
+	return rcgl_ctx_palkeys(&defctx, pals, times, n, first, last, loop);
+}
+
+void rcgl_palstop(int id)
+{
+	rcgl_ctx_palstop(&defctx, id);
+}
+
+void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
+{
+	rcgl_ctx_line(&defctx, x1, y1, x2, y2, c);
+}
+
+void rcgl_lines(const int *xy, int n, uint8_t c)
+{
+	rcgl_ctx_lines(&defctx, xy, n, c);
+}
+
+void rcgl_setclip(int x, int y, int w, int h)
+{
+	rcgl_ctx_setclip(&defctx, x, y, w, h);
+}
+
+void rcgl_rect(int x, int y, int w, int h, uint8_t c)
+{
+	rcgl_ctx_rect(&defctx, x, y, w, h, c);
+}
+
+void rcgl_fillrect(int x, int y, int w, int h, uint8_t c)
+{
+	rcgl_ctx_fillrect(&defctx, x, y, w, h, c);
+}
+
+void rcgl_ellipse(int x, int y, int rx, int ry, uint8_t c)
+{
+	rcgl_ctx_ellipse(&defctx, x, y, rx, ry, c);
+}
+
+void rcgl_fillellipse(int x, int y, int rx, int ry, uint8_t c)
+{
+	rcgl_ctx_fillellipse(&defctx, x, y, rx, ry, c);
+}
+
+void rcgl_circle(int x, int y, int r, uint8_t c)
+{
+	rcgl_ctx_circle(&defctx, x, y, r, c);
+}
+
+void rcgl_fillcircle(int x, int y, int r, uint8_t c)
+{
+	rcgl_ctx_fillcircle(&defctx, x, y, r, c);
+}
+
+void rcgl_arc(int x, int y, int r, int a1, int a2, uint8_t c)
+{
+	rcgl_ctx_arc(&defctx, x, y, r, a1, a2, c);
+}
+
+void rcgl_triangle(int x1, int y1, int x2, int y2, int x3, int y3, uint8_t c)
+{
+	rcgl_ctx_triangle(&defctx, x1, y1, x2, y2, x3, y3, c);
+}
+
+void rcgl_filltriangle(int x1, int y1, int x2, int y2, int x3, int y3,
+                       uint8_t c)
+{
+	rcgl_ctx_filltriangle(&defctx, x1, y1, x2, y2, x3, y3, c);
+}
+
+void rcgl_polygon(const int *xy, int n, uint8_t c)
+{
+	rcgl_ctx_polygon(&defctx, xy, n, c);
+}
+
+void rcgl_fillpolygon(const int *xy, int n, uint8_t c)
+{
+	rcgl_ctx_fillpolygon(&defctx, xy, n, c);
+}
+
+void rcgl_setfont(const rcgl_font *f)
+{
+	rcgl_ctx_setfont(&defctx, f);
+}
+
+int rcgl_text(int x, int y, const char *str, int fg, int bg)
+{
+	return rcgl_ctx_text(&defctx, x, y, str, fg, bg);
+}
+
+void rcgl_texts(const rcgl_textitem *items, int n)
+{
+	rcgl_ctx_texts(&defctx, items, n);
+}
+
+void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt)
+{
+	rcgl_ctx_blit(&defctx, b, x, y, w, h, trans, plt);
+}
+
+void rcgl_sprite_draw(const rcgl_sprite *s, int x, int y, const uint8_t *plt)
+{
+	rcgl_ctx_sprite_draw(&defctx, s, x, y, plt);
+}
+
+void rcgl_blit_rect(const uint8_t *b, int pitch, int sx, int sy, int w, int h,
+                    int x, int y, int flags, int trans, const uint8_t *plt)
+{
+	rcgl_ctx_blit_rect(&defctx, b, pitch, sx, sy, w, h, x, y, flags, trans,
+	                   plt);
+}
+
+void rcgl_atlas_draw(const rcgl_atlas *a, int frame, int x, int y, int flags,
+                     int trans, const uint8_t *plt)
+{
+	rcgl_ctx_atlas_draw(&defctx, a, frame, x, y, flags, trans, plt);
+}
+
+void rcgl_blit_affine(const uint8_t *b, int pitch, int w, int h,
+                      const int32_t m[6], int trans, const uint8_t *plt)
+{
+	rcgl_ctx_blit_affine(&defctx, b, pitch, w, h, m, trans, plt);
+}
+
+void rcgl_blit_rotate(const uint8_t *b, int pitch, int w, int h, int x, int y,
+                      int angle, int32_t scale, int trans, const uint8_t *plt)
+{
+	rcgl_ctx_blit_rotate(&defctx, b, pitch, w, h, x, y, angle, scale, trans,
+	                     plt);
+}
+
+void rcgl_blit_mode7(const uint8_t *b, int pitch, int w, int h,
+                     const rcgl_scanline *rows, rcgl_scanfn fn, void *data,
+                     int flags, int trans, const uint8_t *plt)
+{
+	rcgl_ctx_blit_mode7(&defctx, b, pitch, w, h, rows, fn, data, flags,
+	                    trans, plt);
+}
+
+int rcgl_layer_set(int n, const uint8_t *b, int w, int h, int trans)
+{
+	return rcgl_ctx_layer_set(&defctx, n, b, w, h, trans);
+}
+
+void rcgl_layer_scroll(int n, int x, int y)
+{
+	rcgl_ctx_layer_scroll(&defctx, n, x, y);
+}
+
+void rcgl_layer_key(int trans)
+{
+	rcgl_ctx_layer_key(&defctx, trans);
+}
+
+void rcgl_cmd_run(rcgl_cmdlist *l)
+{
+	rcgl_ctx_cmd_run(&defctx, l);
+}
+
+void rcgl_cmd_defer(rcgl_cmdlist *l)
+{
+	rcgl_ctx_cmd_defer(&defctx, l);
+}
+
+void rcgl_stats(rcgl_framestats *st)
+{
+	rcgl_ctx_stats(&defctx, st);
+}
+
+int rcgl_trace_start(const char *path)
+{
+	return rcgl_ctx_trace_start(&defctx, path);
+}
+
+int rcgl_trace_stop(void)
+{
+	return rcgl_ctx_trace_stop(&defctx);
+}
+
+int rcgl_capture_start(const char *path)
+{
+	return rcgl_ctx_capture_start(&defctx, path);
+}
+
+int rcgl_capture_stop(void)
+{
+	return rcgl_ctx_capture_stop(&defctx);
+}
+
+rcgl_shm *rcgl_shm_create(const char *name)
+{
+	return rcgl_ctx_shm_create(&defctx, name);
+}
+
+void rcgl_shm_destroy(void)
+{
+	rcgl_ctx_shm_destroy(&defctx);
+}
+
+
+/* INTERNAL LIBRARY HELPER ROUTINES */
+
+/*
+ * ctxinit - Set up a context, creating its window unless headless
+ * Returns the same as rcgl_init
+ */
+static int ctxinit(rcgl_context *ctx, int w, int h, int ww, int wh,
+                   const char *title, int wflags)
+{
+	int rval = 0;
+	int istat;
+
+	ctx->bw = w;
+	ctx->bh = h;
+
+	ctx->cargs.w = w;
+	ctx->cargs.h = h;
+	ctx->cargs.ww = ww;
+	ctx->cargs.wh = wh;
+	ctx->cargs.title = title;
+	ctx->cargs.wflags = wflags;
+
+	ctx->dirtymode = (wflags & RCGL_DIRTYRECT) != 0;
+	ctx->ndirty = 0;
+	damage(ctx, 0, 0, w, h);
+	ctx->fpending = ctx->fbusy = -1;
+	ctx->font = &RCGL_FONT_CGA;
+
+	// Create internal framebuffer
+	if ((ctx->ibuf = calloc(w*h, sizeof(uint8_t))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate internal framebuffer\n");
+		rval = -1;
+		goto failalloc;
+	}
+	ctx->buf = ctx->ibuf;
+	rcgl_ctx_setclip(ctx, 0, 0, 0, 0);
+
+	// Frames convert one to one till a window is laid out
+	ctx->xpos = malloc((size_t)(w + h + 2) * sizeof(int));
+	if (ctx->xpos == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate scaler tables\n");
+		rval = -1;
+		goto failpos;
+	}
+	ctx->ypos = ctx->xpos + w + 1;
+	scaletables(ctx, w, h);
+	ctx->scalemode = ctx->wantscale = RCGL_SCALE_AUTO;
+	ctx->aspw = ctx->asph = ctx->wantaspw = ctx->wantasph = 0;
+	ctx->relayout = 0;
+
+	// No layers, the buffer's 0 shows them once there are
+	memset(&ctx->layers, 0, sizeof(ctx->layers));
+	ctx->ulayers = ctx->layers;
+	ctx->drawlayers = &ctx->ulayers;
+
+	// Set default palette
+	rcgl_ctx_setpalette(ctx, RCGL_PALETTE_VGA);
+
+	// Vsync is on unless asked otherwise
+	if (wflags & RCGL_NOVSYNC)
+		SDL_AtomicSet(&ctx->wantvsync, RCGL_VSYNC_OFF);
+	else if (wflags & RCGL_ADAPTIVEVSYNC)
+		SDL_AtomicSet(&ctx->wantvsync, RCGL_VSYNC_ADAPTIVE);
+	else
+		SDL_AtomicSet(&ctx->wantvsync, RCGL_VSYNC_ON);
+	ctx->vsyncmode = SDL_AtomicGet(&ctx->wantvsync);
+	ctx->pacedeadline = 0;
+
+	// No frames timed yet
+	memset(ctx->stages, 0, sizeof(ctx->stages));
+	ctx->lastpresent = 0;
+	ctx->fshown = ctx->fdropped = 0;
+
+	// No input yet
+	memset(&ctx->instate, 0, sizeof(ctx->instate));
+	memset(ctx->inbuf, 0, sizeof(ctx->inbuf));
+	SDL_AtomicSet(&ctx->evhead, 0);
+	SDL_AtomicSet(&ctx->evtail, 0);
+	SDL_AtomicSet(&ctx->inmid, 1);
+	ctx->inback = 0;
+	ctx->infront = 2;
+
+	ctx->mutex = SDL_CreateMutex();
+	if (ctx->mutex == NULL) {
+		fprintf(stderr, "RCGL: Failed to create mutex\n");
+		rval = -2;
+		goto failmutex;
+	}
+	ctx->initcond = SDL_CreateCond();
+	if (ctx->initcond == NULL) {
+		fprintf(stderr, "RCGL: Failed to create init condition variable\n");
+		rval = -2;
+		goto failcond;
+	}
+	ctx->waitdrawcond = SDL_CreateCond();
+	if (ctx->waitdrawcond == NULL) {
+		fprintf(stderr, "RCGL: Failed to create wdraw condition variable\n");
+		rval = -2;
+		goto failcond2;
+	}
+
+	if (lockctx() < 0) {
+		rval = -2;
+		goto failevent;
+	}
+	if (sharedinit() < 0) {
+		SDL_UnlockMutex(ctxlock);
+		rval = -2;
+		goto failevent;
+	}
+	ncontexts++;
+	SDL_UnlockMutex(ctxlock);
+
+	// Without a window there's no video thread, updates render straight
+	// into an ARGB buffer on the calling thread
+	ctx->headless = (wflags & RCGL_HEADLESS) != 0;
+	if (ctx->headless) {
+		if ((ctx->hbuf = calloc((size_t)w*h, sizeof(uint32_t))) == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate output buffer\n");
+			rval = -1;
+			goto failthread;
+		}
+		SDL_AtomicSet(&ctx->status, 1);
+		rcgl_ctx_update(ctx);
+		return rval;
+	}
+
+	// The first window starts the video thread, later ones ask it for their
+	// window. The lock is kept till the window is up so nobody else sees
+	// the thread half started, which is why it's a mutex others sleep on.
+	SDL_LockMutex(ctxlock);
+	if (nwindows == 0) {
+		evthread = SDL_CreateThread(videothread, "RCGLWindowThread", ctx);
+		if (evthread == NULL) {
+			SDL_UnlockMutex(ctxlock);
+			fprintf(stderr, "RCGL: Failed to create RCGLWindowThread: %s\n",
+			        SDL_GetError());
+			rval = -3;
+			goto failthread;
+		}
+	}
+	else {
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = EVENT_CREATE;
+		event.user.data1 = ctx;
+		SDL_PushEvent(&event);
+	}
+	nwindows++;
+
+	// Block till the window has been created, or till an error occurs
+	SDL_LockMutex(ctx->mutex);
+	while (!ctx->initstatus) {
+		SDL_CondWait(ctx->initcond, ctx->mutex);
+	}
+	istat = ctx->initstatus;
+	SDL_UnlockMutex(ctx->mutex);
+	if (istat < 0) { // Failure to init
+		fprintf(stderr, "RCGL: Error intializing in video thread\n");
+		rval = istat;
+		windowdone();
+		SDL_UnlockMutex(ctxlock);
+		goto failthread;
+	}
+	SDL_UnlockMutex(ctxlock);
+	// Otherwise the window is ready
+	// Clear the screen
+	rcgl_ctx_update(ctx);
+	
+	return rval;
+	// Failure path
+failthread:
+	SDL_LockMutex(ctxlock);
+	ncontexts--;
+	SDL_UnlockMutex(ctxlock);
+failevent:
+	SDL_DestroyCond(ctx->waitdrawcond);
+failcond2:
+	SDL_DestroyCond(ctx->initcond);
+failcond:
+	SDL_DestroyMutex(ctx->mutex);
+failmutex:
+	free(ctx->xpos);
+	ctx->xpos = ctx->ypos = NULL;
+failpos:
+	free(ctx->ibuf);
+	ctx->ibuf = NULL;
+	ctx->buf = NULL;
+failalloc:
+	return rval;
+}
+
+/*
+ * lockctx - Lock ctxlock, creating it the first time through
+ * Returns -1 if it can't be created.
+ */
+static int lockctx(void)
+{
+	SDL_AtomicLock(&ctxlockmade);
+	if (ctxlock == NULL && (ctxlock = SDL_CreateMutex()) == NULL) {
+		SDL_AtomicUnlock(&ctxlockmade);
+		fprintf(stderr, "RCGL: Failed to create context mutex\n");
+		return -1;
+	}
+	SDL_AtomicUnlock(&ctxlockmade);
+	SDL_LockMutex(ctxlock);
+	return 0;
+}
+
+/*
+ * sharedinit - Set up what every context shares, the first time through
+ * Call with ctxlock held. Returns -1 on error.
+ */
+static int sharedinit(void)
+{
+	if (EVENT_TERM)
+		return 0;
+
+	// Each glyph row pattern as the 8 pixels it covers
+	for (int i = 0; i < 256; i++) {
+		uint8_t m[8];
+		for (int j = 0; j < 8; j++)
+			m[j] = (i & (0x80 >> j)) ? 0xff : 0x00;
+		memcpy(&glyphmask[i], m, 8);
+	}
+
+	// Pick the fastest palette expansion routine available
+	blitrow = blitrow_c;
+#ifdef RCGL_HAVE_AVX2
+	if (SDL_HasAVX2())
+		blitrow = blitrow_avx2;
+#endif
+
+	// Create user defined events
+	EVENT_TERM = SDL_RegisterEvents(5);
+	if (EVENT_TERM == (uint32_t)-1) {
+		fprintf(stderr, "RCGL: Failed to create user events\n");
+		EVENT_TERM = 0;
+		return -1;
+	}
+	EVENT_REDRAW = EVENT_TERM+1;
+	EVENT_CREATE = EVENT_TERM+2;
+	EVENT_DESTROY = EVENT_TERM+3;
+	EVENT_SHM = EVENT_TERM+4;
+	return 0;
+}
+
+/*
+ * windowdone - Stop the video thread once the last window is gone
+ * Call with ctxlock held
+ */
+static void windowdone(void)
+{
+	SDL_Event event;
+
+	if (--nwindows > 0)
+		return;
+	SDL_zero(event);
+	event.type = EVENT_TERM;
+	SDL_PushEvent(&event);
+	SDL_WaitThread(evthread, NULL);
+	evthread = NULL;
+}
+
+/*
+ * blit - Render region r of 8-bit bitmap to 32-bit bitmap using palette
+ * dst points at the top left of r, rows are pitch bytes apart as handed back
+ * by SDL_LockTexture. Colours come from the plut palette snapshot.
+ */
+static void blit(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                 int pitch, const SDL_Rect *r)
+{
+	size_t w;
+
+	if (layered(ctx)) {
+		blitlayers(ctx, src, dst, pitch, r);
+		return;
+	}
+
+	src += r->y * ctx->bw + r->x;
+	if (!ctx->scaled) {
+		for (int y = 0; y < r->h; y++) {
+			blitrow(src, (uint32_t *)dst, r->w, ctx->plut);
+			src += ctx->bw;
+			dst += pitch;
+		}
+		return;
+	}
+
+	// Scaled, each row is expanded once then copied down for its repeats
+	w = (ctx->xpos[r->x + r->w] - ctx->xpos[r->x]) * sizeof(uint32_t);
+	for (int y = r->y; y < r->y + r->h; y++) {
+		int n = ctx->ypos[y + 1] - ctx->ypos[y];
+
+		if (n > 0) {
+			scalerow(ctx, src, (uint32_t *)dst, r->x, r->w);
+			for (int i = 1; i < n; i++)
+				memcpy(dst + i * pitch, dst, w);
+			dst += n * pitch;
+		}
+		src += ctx->bw;
+	}
+}
+
+/*
+ * blitlayers - blit() for frames with layers behind the buffer
+ * Rows are composited a piece at a time into a row of indices, which is then
+ * expanded the same as the buffer's own would be.
+ */
+static void blitlayers(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                       int pitch, const SDL_Rect *r)
+{
+	uint8_t row[256];
+	size_t w = (ctx->xpos[r->x + r->w] - ctx->xpos[r->x]) * sizeof(uint32_t);
+
+	for (int y = r->y; y < r->y + r->h; y++) {
+		int n = ctx->ypos[y + 1] - ctx->ypos[y];
+
+		if (n == 0)
+			continue;
+		for (int c = 0; c < r->w; c += sizeof(row)) {
+			int x = r->x + c;
+			int k = (r->w - c < (int)sizeof(row)) ? r->w - c : (int)sizeof(row);
+
+			composite(ctx->drawlayers, row, src + y * ctx->bw + x, x, y,
+			          k);
+			scalerow(ctx, row,
+			         (uint32_t *)dst + (ctx->xpos[x] - ctx->xpos[r->x]), x, k);
+		}
+		for (int i = 1; i < n; i++)
+			memcpy(dst + i * pitch, dst, w);
+		dst += n * pitch;
+	}
+}
+
+/*
+ * composite - Stack n pixels at x,y of the layers and buffer into dst
+ * The backmost layer is copied solid, the rest are keyed on in order, and the
+ * buffer goes on top.
+ */
+static void composite(const struct LAYERS *ls, uint8_t *dst,
+                      const uint8_t *src, int x, int y, int n)
+{
+	int back = 1;
+
+	for (int i = 0; i < ls->n; i++) {
+		const struct LAYER *l = &ls->l[i];
+		const uint8_t *row;
+		int lx;
+
+		if (l->b == NULL)
+			continue;
+
+		// Wrapping splits the row into pieces from lx to the layer's edge
+		row = l->b + ((y + l->sy) % l->h) * l->w;
+		lx = (x + l->sx) % l->w;
+		for (int c = 0; c < n; ) {
+			int k = (n - c < l->w - lx) ? n - c : l->w - lx;
+
+			if (back || l->trans < 0)
+				memcpy(dst + c, row + lx, k);
+			else
+				keyrow(dst + c, row + lx, k, l->trans);
+			c += k;
+			lx = 0;
+		}
+		back = 0;
+	}
+	keyrow(dst, src, n, ls->key);
+}
+
+/*
+ * composited - The frame SDL's blitter should convert from src
+ * With layers the damaged parts are composited into cbuf, and that's used.
+ */
+static const uint8_t *composited(rcgl_context *ctx, const uint8_t *src,
+                                 const SDL_Rect *rects, int nrects)
+{
+	if (!layered(ctx))
+		return src;
+	if (ctx->cbuf == NULL
+	    && (ctx->cbuf = malloc((size_t)ctx->bw * ctx->bh)) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate layer buffer\n");
+		return src;
+	}
+
+	for (int i = 0; i < nrects; i++) {
+		const SDL_Rect *r = &rects[i];
+		for (int y = r->y; y < r->y + r->h; y++) {
+			size_t o = (size_t)y * ctx->bw + r->x;
+			composite(ctx->drawlayers, ctx->cbuf + o, src + o, r->x, y,
+			          r->w);
+		}
+	}
+	return ctx->cbuf;
+}
+
+/*
+ * layered - Whether the frame being drawn has layers showing behind it
+ */
+static int layered(rcgl_context *ctx)
+{
+	return ctx->drawlayers->n > 0 && ctx->drawlayers->key >= 0;
+}
+
+/*
+ * scalerow - Palette expansion of n pixels starting at column x, scaled
+ * Whole number widths repeat every pixel the same, anything else follows
+ * the column table.
+ */
+static void scalerow(rcgl_context *ctx, const uint8_t *src, uint32_t *dst,
+                     int x, int n)
+{
+	const uint32_t *lut = ctx->plut;
+	const int *xp = ctx->xpos + x;
+
+	switch (ctx->xrep) {
+	case 1:
+		blitrow(src, dst, n, lut);
+		break;
+	case 2:
+		for (int i = 0; i < n; i++, dst += 2)
+			dst[0] = dst[1] = lut[src[i]];
+		break;
+	case 0:
+		for (int i = 0; i < n; i++) {
+			uint32_t p = lut[src[i]];
+			for (int k = xp[i]; k < xp[i + 1]; k++)
+				*dst++ = p;
+		}
+		break;
+	default:
+		for (int i = 0; i < n; i++) {
+			uint32_t p = lut[src[i]];
+			for (int k = 0; k < ctx->xrep; k++)
+				*dst++ = p;
+		}
+		break;
+	}
+}
+
+/*
+ * scalerect - Where a rectangle of the buffer ends up once converted
+ */
+static SDL_Rect scalerect(rcgl_context *ctx, const SDL_Rect *r)
+{
+	SDL_Rect s;
+
+	s.x = ctx->xpos[r->x];
+	s.y = ctx->ypos[r->y];
+	s.w = ctx->xpos[r->x + r->w] - s.x;
+	s.h = ctx->ypos[r->y + r->h] - s.y;
+	return s;
+}
+
+/*
+ * scaletables - Map the buffer onto a w by h converted frame, nearest pixel
+ */
+static void scaletables(rcgl_context *ctx, int w, int h)
+{
+	for (int x = 0; x <= ctx->bw; x++)
+		ctx->xpos[x] = (int)((int64_t)x * w / ctx->bw);
+	for (int y = 0; y <= ctx->bh; y++)
+		ctx->ypos[y] = (int)((int64_t)y * h / ctx->bh);
+	ctx->xrep = (w % ctx->bw == 0) ? w / ctx->bw : 0;
+	ctx->scaled = w != ctx->bw || h != ctx->bh;
+}
+
+/*
+ * line - Draw a line clipped to the clip rectangle
+ * Bresenham's line drawing algorithm, starting part way along the line when
+ * the start is clipped so the same pixels are drawn as without clipping.
+ */
+static void line(const struct TARGET *dst, int x1, int y1, int x2, int y2,
+                 uint8_t c)
+{
+	int dx, dy;
+	int adx, ady;
+	int sdx, sdy;
+	int lo, hi;
+	int x, y, e;
+	int majstep, minstep;
+	int admaj, admin;
+	uint8_t *p;
+
+	dx = x2 - x1;
+	dy = y2 - y1;
+
+	// Horizontal and vertical lines are just spans
+	if (dy == 0) {
+		if (y1 < dst->cy1 || y1 >= dst->cy2)
+			return;
+		if (x1 > x2) {
+			x = x1; x1 = x2; x2 = x;
+		}
+		if (x1 < dst->cx1) x1 = dst->cx1;
+		if (x2 >= dst->cx2) x2 = dst->cx2 - 1;
+		if (x1 <= x2)
+			memset(dst->buf + y1 * dst->bw + x1, c, x2 - x1 + 1);
+		return;
+	}
+	if (dx == 0) {
+		if (x1 < dst->cx1 || x1 >= dst->cx2)
+			return;
+		if (y1 > y2) {
+			y = y1; y1 = y2; y2 = y;
+		}
+		if (y1 < dst->cy1) y1 = dst->cy1;
+		if (y2 >= dst->cy2) y2 = dst->cy2 - 1;
+		for (p = dst->buf + y1 * dst->bw + x1; y1 <= y2; y1++, p += dst->bw)
+			*p = c;
+		return;
+	}
+
+	// With the abs we can pretend to only be in octant 1 or 0
+	adx = abs(dx);
+	ady = abs(dy);
+
+	// Figure out the actual octant for the line
+	sdx = (dx > 0) ? 1 : -1;
+	sdy = (dy > 0) ? 1 : -1;
+
+	// Work out which steps along the major axis land inside the clip, and
+	// the position and error at the first of them
+	if (adx >= ady) { // Octant 0 (y rises slower than x)
+		if (!clipsteps(&lo, &hi, x1, sdx, adx, dst->cx1, dst->cx2 - 1,
+		               y1, sdy, ady, dst->cy1, dst->cy2 - 1))
+			return;
+		x = x1 + sdx * lo;
+		y = y1 + sdy * (int)((int64_t)lo * ady / adx);
+		e = (int)((int64_t)lo * ady % adx);
+		majstep = sdx;
+		minstep = sdy * dst->bw;
+		admaj = adx;
+		admin = ady;
+	}
+	else { // Octant 1 (x rises slower than y)
+		if (!clipsteps(&lo, &hi, y1, sdy, ady, dst->cy1, dst->cy2 - 1,
+		               x1, sdx, adx, dst->cx1, dst->cx2 - 1))
+			return;
+		y = y1 + sdy * lo;
+		x = x1 + sdx * (int)((int64_t)lo * adx / ady);
+		e = (int)((int64_t)lo * adx % ady);
+		majstep = sdy * dst->bw;
+		minstep = sdx;
+		admaj = ady;
+		admin = adx;
+	}
+
+	p = dst->buf + y * dst->bw + x;
+	for (int i = lo; i <= hi; i++) {
+		*p = c;
+		e += admin;
+		if (e >= admaj) { // If we're past the increment point of the minor axis
+			e -= admaj;   // Reset, but propogate error
+			p += minstep;
+		}
+		p += majstep;
+	}
+}
+
+/*
+ * clipsteps - Find the steps of a line that fall inside the clip
+ * a is the major axis, b the minor. Step i is at a1 + sa*i along a, and
+ * b1 + sb*floor(i*adb/ada) along b, both of which must be within lo..hi.
+ * Returns 0 if no part of the line is visible.
+ */
+static int clipsteps(int *lo, int *hi, int a1, int sa, int ada, int alo,
+                     int ahi, int b1, int sb, int adb, int blo, int bhi)
+{
+	int64_t l, h, kl, kh;
+
+	// Major axis moves one pixel per step
+	l = (sa > 0) ? alo - a1 : a1 - ahi;
+	h = (sa > 0) ? ahi - a1 : a1 - alo;
+	if (l < 0) l = 0;
+	if (h > ada) h = ada;
+
+	// Minor axis has moved floor(i*adb/ada) pixels by step i
+	kl = (sb > 0) ? blo - b1 : b1 - bhi;
+	kh = (sb > 0) ? bhi - b1 : b1 - blo;
+	if (kh < 0 || kl > adb)
+		return 0;
+	if (kl > 0) {
+		kl = (kl * ada + adb - 1) / adb;
+		if (kl > l) l = kl;
+	}
+	if (kh < adb) {
+		kh = ((kh + 1) * ada + adb - 1) / adb - 1;
+		if (kh < h) h = kh;
+	}
+
+	if (l > h)
+		return 0;
+	*lo = (int)l;
+	*hi = (int)h;
+	return 1;
+}
+
+/*
+ * keyrow - Copy n pixels, leaving dst alone wherever src is the key colour
+ */
+static void keyrow(uint8_t *dst, const uint8_t *src, int n, uint8_t key)
+{
+	int x = 0;
+
+#ifdef RCGL_HAVE_SSE2
+	__m128i k = _mm_set1_epi8((char)key);
+
+	for (; x + 16 <= n; x += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+		__m128i m = _mm_cmpeq_epi8(s, k);
+
+		d = _mm_or_si128(_mm_and_si128(m, d), _mm_andnot_si128(m, s));
+		_mm_storeu_si128((__m128i *)(dst + x), d);
+	}
+#endif
+	for (; x < n; x++)
+		if (src[x] != key)
+			dst[x] = src[x];
+}
+
+/*
+ * maprow - Copy n pixels through the lookup table plt
+ */
+static void maprow(uint8_t *dst, const uint8_t *src, int n,
+                   const uint8_t *plt)
+{
+	int x = 0;
+
+	for (; x + 4 <= n; x += 4) {
+		dst[x+0] = plt[src[x+0]];
+		dst[x+1] = plt[src[x+1]];
+		dst[x+2] = plt[src[x+2]];
+		dst[x+3] = plt[src[x+3]];
+	}
+	for (; x < n; x++)
+		dst[x] = plt[src[x]];
+}
+
+/*
+ * fliprow - Copy n pixels backwards from src, its rightmost pixel
+ * Remapped through plt if it's not NULL, then keyed against trans if it's
+ * 0-255, the same as rcgl_blit.
+ */
+static void fliprow(uint8_t *dst, const uint8_t *src, int n, int trans,
+                    const uint8_t *plt)
+{
+	if (plt == NULL && trans < 0) {
+		for (int x = 0; x < n; x++)
+			dst[x] = src[-x];
+	}
+	else if (plt == NULL) {
+		for (int x = 0; x < n; x++)
+			if (src[-x] != trans)
+				dst[x] = src[-x];
+	}
+	else if (trans < 0) {
+		for (int x = 0; x < n; x++)
+			dst[x] = plt[src[-x]];
+	}
+	else {
+		for (int x = 0; x < n; x++) {
+			uint8_t c = plt[src[-x]];
+			if (c != trans)
+				dst[x] = c;
+		}
+	}
+}
+
+/*
+ * blitrect - Copy a w x h bitmap, pitch bytes a row, to x,y
+ * Clipped to the clip rectangle, with the clipped part skipped from
+ * whichever side the flips in flags put it on.
+ */
+static void blitrect(const struct TARGET *dst, const uint8_t *b, int pitch,
+                     int x, int y, int w, int h, int flags, int trans,
+                     const uint8_t *plt)
+{
+	int sw = w, sh = h;         // Size before clipping
+	int l = 0, t = 0;           // Clipped off the left and top
+	int step = pitch;           // Source row to row
+	uint8_t *fb;
+	uint8_t tmp[256];
+
+	// Clip to the clip rectangle
+	if (x < dst->cx1) {
+		l = dst->cx1 - x;
+		w -= l;
+		x = dst->cx1;
+	}
+	if (y < dst->cy1) {
+		t = dst->cy1 - y;
+		h -= t;
+		y = dst->cy1;
+	}
+	if (x + w > dst->cx2)
+		w = dst->cx2 - x;
+	if (y + h > dst->cy2)
+		h = dst->cy2 - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	// No index can ever match a key outside 0-255
+	if (trans > 255)
+		trans = -1;
+
+	// Start from the source pixel that lands top left
+	if (flags & RCGL_FLIPY) {
+		b += (sh - 1 - t) * pitch;
+		step = -pitch;
+	}
+	else
+		b += t * pitch;
+	b += (flags & RCGL_FLIPX) ? sw - 1 - l : l;
+
+	fb = dst->buf + (y * dst->bw) + x;
+	for (int r = 0; r < h; r++, b += step, fb += dst->bw) {
+		if (flags & RCGL_FLIPX)
+			fliprow(fb, b, w, trans, plt);
+		else if (plt == NULL) {
+			if (trans < 0)
+				memcpy(fb, b, w);
+			else
+				keyrow(fb, b, w, trans);
+		}
+		else if (trans < 0)
+			maprow(fb, b, w, plt);
+		else {
+			// Remap a piece at a time, then key the remapped pixels
+			for (int c = 0; c < w; c += sizeof(tmp)) {
+				int n = (w - c < (int)sizeof(tmp)) ? w - c : (int)sizeof(tmp);
+				maprow(tmp, b + c, n, plt);
+				keyrow(fb + c, tmp, n, trans);
+			}
+		}
+	}
+}
+
+/*
+ * spanclip - Narrow steps lo..hi to those where a + i*da is within 0..max-1
+ * Leaves lo > hi if none are.
+ */
+static void spanclip(int *lo, int *hi, int64_t a, int64_t da, int64_t max)
+{
+	int64_t l, h;
+
+	if (da == 0) {
+		if (a < 0 || a >= max)
+			*lo = *hi + 1;
+		return;
+	}
+	if (da < 0) {
+		// Walk it the other way round
+		da = -da;
+		l = a - (max - 1);
+		h = a;
+	}
+	else {
+		l = -a;
+		h = max - 1 - a;
+	}
+
+	// First step at or past l, last step at or before h
+	l = (l > 0) ? (l + da - 1) / da : -(-l / da);
+	h = (h >= 0) ? h / da : -((-h + da - 1) / da);
+	if (l > *lo)
+		*lo = (l > *hi) ? *hi + 1 : (int)l;
+	if (h < *hi)
+		*hi = (h < *lo) ? *lo - 1 : (int)h;
+}
+
+/*
+ * wrapfix - Reduce 16.16 fixed point a into 0..m-1
+ */
+static uint32_t wrapfix(int64_t a, int64_t m)
+{
+	a %= m;
+	return (uint32_t)((a < 0) ? a + m : a);
+}
+
+/*
+ * texrow - Draw n pixels to dst sampled from a bitmap, pitch bytes a row
+ * The 16.16 position u,v steps by du,dv each pixel. If ww is not 0 it wraps
+ * around the ww x wh bitmap, with everything already reduced to fit it,
+ * otherwise every step has to land on the bitmap. Sampled pixels are
+ * remapped and keyed a piece at a time, as in blitrect.
+ */
+static void texrow(uint8_t *dst, const uint8_t *b, int pitch, uint32_t u,
+                   uint32_t v, uint32_t du, uint32_t dv, int n, uint32_t ww,
+                   uint32_t wh, int trans, const uint8_t *plt)
+{
+	uint8_t tmp[256];
+
+	while (n > 0) {
+		int c = (n < (int)sizeof(tmp)) ? n : (int)sizeof(tmp);
+
+		if (ww) {
+			for (int i = 0; i < c; i++) {
+				tmp[i] = b[(v >> 16) * pitch + (u >> 16)];
+				u += du;
+				v += dv;
+				u -= (u >= ww) ? ww : 0;
+				v -= (v >= wh) ? wh : 0;
+			}
+		}
+		else if (dv == 0) {
+			// Rows that don't cross the bitmap's rows
+			const uint8_t *row = b + (v >> 16) * pitch;
+			for (int i = 0; i < c; i++, u += du)
+				tmp[i] = row[u >> 16];
+		}
+		else {
+			for (int i = 0; i < c; i++, u += du, v += dv)
+				tmp[i] = b[(v >> 16) * pitch + (u >> 16)];
+		}
+
+		if (plt)
+			maprow(tmp, tmp, c, plt);
+		if (trans < 0)
+			memcpy(dst, tmp, c);
+		else
+			keyrow(dst, tmp, c, trans);
+		dst += c;
+		n -= c;
+	}
+}
+
+/*
+ * render - Palettize the damaged regions of src into the output
+ * Returns 1 on success, 0 if the output couldn't be written
+ */
+static int render(rcgl_context *ctx, const uint8_t *src, const uint32_t *pal,
+                  SDL_Rect *rects, int *nrects)
+{
+	int dstatus = 1;
+	int palchanged = 0;
+	uint8_t changed[256];
+	uint64_t t = SDL_GetPerformanceCounter();
+
+	memset(ctx->ftimes, 0, sizeof(ctx->ftimes));
+
+	// Without tracked damage, work out what changed since last frame. Layers
+	// can change anywhere so there's nothing to go on, the last frame's copy
+	// is dropped to start afresh once they're gone.
+	if (layered(ctx)) {
+		free(ctx->shadow);
+		ctx->shadow = NULL;
+	}
+	else if (!ctx->dirtymode)
+		diffrows(ctx, src, rects, nrects);
+	if (*nrects > 0 || src != ctx->irowsrc)
+		ctx->irowsrc = NULL;
+
+	// Fold the opaque alpha into a snapshot of the palette
+	for (int i = 0; i < 256; i++) {
+		uint32_t p = pal[i] | 0xFF000000;
+		changed[i] = ctx->plut[i] != p;
+		if (changed[i]) {
+			ctx->plut[i] = p;
+			palchanged = 1;
+		}
+	}
+
+	// Only rows using a changed palette entry need to be redone, which the
+	// buffer alone can't say when there are layers
+	if (palchanged && layered(ctx))
+		damagelist(ctx, rects, nrects, 0, 0, ctx->bw, ctx->bh);
+	else if (palchanged) {
+		int y1 = ctx->bh, y2 = -1;
+
+		if (ctx->irowsrc == NULL) {
+			indexrows(ctx, src);
+			ctx->irowsrc = src;
+		}
+		for (int i = 0; i < 256; i++) {
+			if (changed[i] && ctx->irowmin[i] < y1) y1 = ctx->irowmin[i];
+			if (changed[i] && ctx->irowmax[i] > y2) y2 = ctx->irowmax[i];
+		}
+		if (y1 <= y2)
+			damagelist(ctx, rects, nrects, 0, y1, ctx->bw, y2 - y1 + 1);
+	}
+	timed(ctx, RCGL_STAGE_DIFF, t);
+
+	// Unless it's scaling itself, SDL does the conversion when blitting to
+	// the window surface. It only needs to know about palette changes.
+	if (ctx->surfmode && !ctx->direct) {
+		if (palchanged)
+			surfacepal(ctx);
+		ctx->isurf->pixels = (void *)composited(ctx, src, rects, *nrects);
+		t = SDL_GetPerformanceCounter();
+		for (int i = 0; i < *nrects; i++) {
+			SDL_Rect d = rects[i];
+			if (!ctx->ssurf) {
+				d.x += ctx->sdst.x;
+				d.y += ctx->sdst.y;
+			}
+			if (SDL_BlitSurface(ctx->isurf, &rects[i],
+			                    ctx->ssurf ? ctx->ssurf : ctx->wsurf, &d) < 0)
+				dstatus = 0;
+		}
+		ctx->isurf->pixels = NULL;     // src isn't ours to keep
+		timed(ctx, RCGL_STAGE_CONVERT, t);
+		return dstatus;
+	}
+
+	// Palettize and copy only the damaged regions
+	for (int i = 0; i < *nrects; i++)
+		if (!convert(ctx, src, &rects[i]))
+			dstatus = 0;
+	return dstatus;
+}
+
+/*
+ * convert - Palettize one damaged rectangle of src into the output
+ * Scaled on the way if layout() asked for it. Returns 0 if the texture
+ * couldn't be locked.
+ */
+static int convert(rcgl_context *ctx, const uint8_t *src, const SDL_Rect *r)
+{
+	SDL_Rect s = scalerect(ctx, r);
+	uint64_t t = SDL_GetPerformanceCounter();
+	uint8_t *dst;
+	void *rbuf;
+	int pitch;
+	int locked;
+
+	if (s.w <= 0 || s.h <= 0)
+		return 1;
+
+	if (ctx->headless || ctx->direct) {
+		if (ctx->headless) {
+			pitch = ctx->bw * sizeof(uint32_t);
+			dst = (uint8_t *)ctx->hbuf;
+		}
+		else {
+			pitch = ctx->wsurf->pitch;
+			dst = (uint8_t *)ctx->wsurf->pixels
+			      + ctx->sdst.y * pitch + ctx->sdst.x * sizeof(uint32_t);
+		}
+		dst += s.y * pitch + s.x * sizeof(uint32_t);
+		pblit(ctx, src, dst, pitch, r);
+		timed(ctx, RCGL_STAGE_CONVERT, t);
+		return 1;
+	}
+
+	locked = SDL_LockTexture(ctx->tx, &s, &rbuf, &pitch) == 0;
+	timed(ctx, RCGL_STAGE_LOCK, t);
+	if (!locked) // Failed to open texture, couldn't render.
+		return 0;
+	t = SDL_GetPerformanceCounter();
+	pblit(ctx, src, rbuf, pitch, r);
+	timed(ctx, RCGL_STAGE_CONVERT, t);
+	t = SDL_GetPerformanceCounter();
+	SDL_UnlockTexture(ctx->tx);
+	timed(ctx, RCGL_STAGE_LOCK, t);
+	return 1;
+}
+
+/*
+ * diffrows - Replace the damage with the parts of src that changed
+ * Used when damage isn't tracked, compares against a copy of the last frame.
+ */
+static void diffrows(rcgl_context *ctx, const uint8_t *src, SDL_Rect *rects,
+                     int *nrects)
+{
+	if (ctx->shadow == NULL) {
+		// Everything is new the first time, just keep the copy
+		if ((ctx->shadow = malloc((size_t)ctx->bw * ctx->bh)) != NULL)
+			memcpy(ctx->shadow, src, (size_t)ctx->bw * ctx->bh);
+		return;
+	}
+
+	*nrects = 0;
+	for (int y = 0; y < ctx->bh; ) {
+		int y1 = y, x1 = ctx->bw, x2 = 0;
+
+		// Gather a run of changed rows, and how far across they changed
+		for (; y < ctx->bh; y++) {
+			const uint8_t *s = src + y * ctx->bw;
+			uint8_t *d = ctx->shadow + y * ctx->bw;
+			int l = 0, r = ctx->bw;
+
+			if (memcmp(s, d, ctx->bw) == 0)
+				break;
+			while (s[l] == d[l])
+				l++;
+			while (s[r-1] == d[r-1])
+				r--;
+			memcpy(d + l, s + l, r - l);
+			if (l < x1) x1 = l;
+			if (r > x2) x2 = r;
+		}
+		if (y > y1)
+			damagelist(ctx, rects, nrects, x1, y1, x2 - x1, y - y1);
+		else
+			y++;
+	}
+}
+
+/*
+ * indexrows - Find the first and last row each palette entry is used in
+ */
+static void indexrows(rcgl_context *ctx, const uint8_t *src)
+{
+	uint8_t seen[256];
+
+	for (int i = 0; i < 256; i++) {
+		ctx->irowmin[i] = ctx->bh;
+		ctx->irowmax[i] = -1;
+	}
+	for (int y = 0; y < ctx->bh; y++, src += ctx->bw) {
+		memset(seen, 0, sizeof(seen));
+		for (int x = 0; x < ctx->bw; x++)
+			seen[src[x]] = 1;
+		for (int i = 0; i < 256; i++) {
+			if (seen[i]) {
+				if (ctx->irowmin[i] > y)
+					ctx->irowmin[i] = y;
+				ctx->irowmax[i] = y;
+			}
+		}
+	}
+}
+
+/*
+ * palanimate - Bring the palette animations up to the current time
+ */
+static void palanimate(rcgl_context *ctx)
+{
+	uint32_t now = SDL_GetTicks();
+
+	for (int a = 0; a < MAXPALANIM; a++) {
+		struct PALANIM *p = &ctx->palanim[a];
+		uint32_t t = now - p->start;
+		int n = p->last - p->first + 1;
+
+		if (!p->used)
+			continue;
+
+		if (p->keys == NULL) {
+			// Cycle, rotating by however many steps we're behind
+			int steps = (int)(t / (uint32_t)abs(p->ms));
+			int k = (steps - p->steps) % n;
+			uint32_t tmp[256];
+
+			if (k == 0)
+				continue;
+			p->steps = steps;
+			if (p->ms < 0)
+				k = n - k;
+			memcpy(tmp, ctx->palette + p->first, n * sizeof(uint32_t));
+			for (int i = 0; i < n; i++)
+				ctx->palette[p->first + (i + k) % n] = tmp[i];
+		}
+		else {
+			// Keyframes, blending between the pair either side of now
+			const uint32_t *times = p->keys + p->nkeys * 256;
+			const uint32_t *k0, *k1;
+			uint32_t span, f;
+			int k;
+
+			if (p->loop && times[p->nkeys-1] > 0)
+				t %= times[p->nkeys-1];
+			for (k = 0; k < p->nkeys - 1 && t >= times[k+1]; k++)
+				;
+			k0 = p->keys + k * 256;
+			if (k == p->nkeys - 1) {
+				// Reached the end
+				memcpy(ctx->palette + p->first, k0 + p->first,
+				       n * sizeof(uint32_t));
+				if (!p->loop)
+					rcgl_ctx_palstop(ctx, a);
+				continue;
+			}
+			k1 = k0 + 256;
+			span = times[k+1] - times[k];
+			f = (uint32_t)((uint64_t)(t - times[k]) * 256 / span);
+			for (int i = p->first; i <= p->last; i++) {
+				uint32_t c = 0;
+				for (int sh = 0; sh < 32; sh += 8) {
+					int c0 = (k0[i] >> sh) & 0xFF;
+					int c1 = (k1[i] >> sh) & 0xFF;
+					c |= (uint32_t)(c0 + (c1 - c0) * (int)f / 256) << sh;
+				}
+				ctx->palette[i] = c;
+			}
+		}
+	}
+}
+
+/*
+ * palkeys - Start a keyframe animation, taking ownership of keys
+ */
+static int palkeys(rcgl_context *ctx, uint32_t *keys, int n, int first,
+                   int last, int loop)
+{
+	const uint32_t *times = keys + n * 256;
+
+	for (int i = 1; i < n; i++) {
+		if (times[i] < times[i-1])
+			goto failkeys;
+	}
+	if (first < 0 || last > 255 || first > last)
+		goto failkeys;
+
+	for (int i = 0; i < MAXPALANIM; i++) {
+		if (ctx->palanim[i].used)
+			continue;
+		memset(&ctx->palanim[i], 0, sizeof(ctx->palanim[i]));
+		ctx->palanim[i].used = 1;
+		ctx->palanim[i].first = first;
+		ctx->palanim[i].last = last;
+		ctx->palanim[i].keys = keys;
+		ctx->palanim[i].nkeys = n;
+		ctx->palanim[i].loop = loop;
+		ctx->palanim[i].start = SDL_GetTicks();
+		return i;
+	}
+	fprintf(stderr, "RCGL: Too many palette animations\n");
+failkeys:
+	free(keys);
+	return -1;
+}
+
+/*
+ * span - Fill pixels x1 up to x2 on row y, clipped
+ */
+static void span(rcgl_context *ctx, int x1, int x2, int y, uint8_t c)
+{
+	if (y < ctx->cy1 || y >= ctx->cy2)
+		return;
+	if (x1 < ctx->cx1)
+		x1 = ctx->cx1;
+	if (x2 > ctx->cx2)
+		x2 = ctx->cx2;
+	if (x1 < x2)
+		memset(&ctx->buf[y * ctx->bw + x1], c, x2 - x1);
+}
+
+/*
+ * pixel - Plot a pixel, clipped, without marking damage
+ */
+static void pixel(rcgl_context *ctx, int x, int y, uint8_t c)
+{
+	if (x >= ctx->cx1 && y >= ctx->cy1 && x < ctx->cx2 && y < ctx->cy2)
+		ctx->buf[y * ctx->bw + x] = c;
+}
+
+/*
+ * ellipse - Draw or fill an ellipse with the midpoint algorithm
+ * Runs down one quarter, mirroring each point into the other three. When
+ * filling, a row's span is drawn once its widest point is known.
+ */
+static void ellipse(rcgl_context *ctx, int x, int y, int rx, int ry, uint8_t c,
+                    int fill)
+{
+	int64_t rx2 = (int64_t)rx * rx, ry2 = (int64_t)ry * ry;
+	int64_t px, py, p;
+	int dx, dy;
+
+	if (rx < 0 || ry < 0)
+		return;
+	if (ctx->dirtymode)
+		damage(ctx, x - rx, y - ry, rx * 2 + 1, ry * 2 + 1);
+
+	// Flat ellipses are just lines
+	if (rx == 0 || ry == 0) {
+		struct TARGET dst = target(ctx);
+
+		line(&dst, x - rx, y - ry, x + rx, y + ry, c);
+		return;
+	}
+
+	#define QUAD(dx, dy) do { \
+		if (fill) { \
+			span(ctx, x - (dx), x + (dx) + 1, y + (dy), c); \
+			if (dy) \
+				span(ctx, x - (dx), x + (dx) + 1, y - (dy), c); \
+		} \
+		else { \
+			pixel(ctx, x + (dx), y + (dy), c); \
+			pixel(ctx, x - (dx), y + (dy), c); \
+			pixel(ctx, x + (dx), y - (dy), c); \
+			pixel(ctx, x - (dx), y - (dy), c); \
+		} \
+	} while (0)
+
+	// Top, where the slope is under 1 and x steps every pixel
+	dx = 0;
+	dy = ry;
+	px = 0;
+	py = 2 * rx2 * dy;
+	p = ry2 - rx2 * ry + rx2 / 4;
+	while (px < py) {
+		if (!fill)
+			QUAD(dx, dy);
+		dx++;
+		px += 2 * ry2;
+		if (p < 0) {
+			p += ry2 + px;
+		}
+		else {
+			if (fill)
+				QUAD(dx - 1, dy);
+			dy--;
+			py -= 2 * rx2;
+			p += ry2 + px - py;
+		}
+	}
+
+	// Side, where y steps every pixel
+	p = ry2 * ((int64_t)dx * dx + dx) + rx2 * ((int64_t)(dy - 1) * (dy - 1))
+	    - rx2 * ry2 + ry2 / 4;
+	while (dy >= 0) {
+		QUAD(dx, dy);
+		dy--;
+		py -= 2 * rx2;
+		if (p > 0) {
+			p += rx2 - py;
+		}
+		else {
+			dx++;
+			px += 2 * ry2;
+			p += rx2 - py + px;
+		}
+	}
+	#undef QUAD
+}
+
+/*
+ * ceildiv - Divide rounding up, b must be positive
+ */
+static int64_t ceildiv(int64_t a, int64_t b)
+{
+	return (a >= 0) ? (a + b - 1) / b : -(-a / b);
+}
+
+/*
+ * edgecmp - Sort edges by their top
+ */
+static int edgecmp(const void *a, const void *b)
+{
+	return ((const struct EDGE *)a)->y1 - ((const struct EDGE *)b)->y1;
+}
+
+/*
+ * fillpoly - Fill a polygon a row at a time from an edge table
+ * Pixel centres on or right of/below an edge are inside, so the square
+ * 0,0 10,0 10,10 0,10 fills the same pixels as rcgl_fillrect(0, 0, 10, 10).
+ */
+static void fillpoly(rcgl_context *ctx, const int *xy, int n, uint8_t c)
+{
+	int ne = 0, nact = 0, next = 0;
+	int top = INT32_MAX, bot = INT32_MIN;
+
+	if (n > ctx->nedges) {
+		struct EDGE *e = realloc(ctx->edges, n * sizeof(*ctx->edges));
+		struct EDGE **a = realloc(ctx->active, n * sizeof(*ctx->active));
+		int *xc = realloc(ctx->xcross, n * sizeof(*ctx->xcross));
+		if (e) ctx->edges = e;
+		if (a) ctx->active = a;
+		if (xc) ctx->xcross = xc;
+		if (e == NULL || a == NULL || xc == NULL) {
+			fprintf(stderr, "RCGL: Failed to allocate polygon edges\n");
+			return;
+		}
+		ctx->nedges = n;
+	}
+
+	// Edge table of every non-flat edge, sorted by top
+	for (int i = 0; i < n; i++) {
+		int j = (i + 1 < n) ? i + 1 : 0;
+		int ax = xy[i*2], ay = xy[i*2+1], bx = xy[j*2], by = xy[j*2+1];
+
+		if (ay == by)
+			continue;
+		if (ay > by) {
+			int t;
+			t = ax; ax = bx; bx = t;
+			t = ay; ay = by; by = t;
+		}
+		ctx->edges[ne].x1 = ax;
+		ctx->edges[ne].y1 = ay;
+		ctx->edges[ne].x2 = bx;
+		ctx->edges[ne].y2 = by;
+		if (ay < top) top = ay;
+		if (by > bot) bot = by;
+		ne++;
+	}
+	if (ne == 0)
+		return;
+	qsort(ctx->edges, ne, sizeof(*ctx->edges), edgecmp);
+
+	if (top < ctx->cy1)
+		top = ctx->cy1;
+	if (bot > ctx->cy2)
+		bot = ctx->cy2;
+	for (int y = top; y < bot; y++) {
+		int nx = 0, k = 0;
+
+		// Add edges starting on this row, drop those that have ended
+		while (next < ne && ctx->edges[next].y1 <= y)
+			ctx->active[nact++] = &ctx->edges[next++];
+		for (int i = 0; i < nact; i++)
+			if (ctx->active[i]->y2 > y)
+				ctx->active[k++] = ctx->active[i];
+		nact = k;
+
+		// Where each edge crosses the row, in order
+		for (int i = 0; i < nact; i++) {
+			const struct EDGE *e = ctx->active[i];
+			int64_t dy = e->y2 - e->y1;
+			int x = (int)ceildiv((int64_t)e->x1 * dy
+			                     + (int64_t)(y - e->y1) * (e->x2 - e->x1), dy);
+			int j = nx++;
+
+			while (j > 0 && ctx->xcross[j - 1] > x) {
+				ctx->xcross[j] = ctx->xcross[j - 1];
+				j--;
+			}
+			ctx->xcross[j] = x;
+		}
+
+		for (int i = 0; i + 1 < nx; i += 2)
+			span(ctx, ctx->xcross[i], ctx->xcross[i + 1], y, c);
+	}
+}
+
+/*
+ * polybounds - Mark the box around a polygon as damaged
+ */
+static void polybounds(rcgl_context *ctx, const int *xy, int n)
+{
+	int x1 = xy[0], y1 = xy[1], x2 = xy[0], y2 = xy[1];
+
+	for (int i = 1; i < n; i++) {
+		if (xy[i*2] < x1) x1 = xy[i*2];
+		if (xy[i*2] > x2) x2 = xy[i*2];
+		if (xy[i*2+1] < y1) y1 = xy[i*2+1];
+		if (xy[i*2+1] > y2) y2 = xy[i*2+1];
+	}
+	damage(ctx, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+}
+
+/*
+ * text - Draw a string, marking the area it covers as damaged
+ */
+static int text(rcgl_context *ctx, int x, int y, const char *str, int fg,
+                int bg)
+{
+	const rcgl_font *f = ctx->font;
+	int sx = x, maxx = x, top = y;
+
+	for (; *str; str++) {
+		unsigned ch = (unsigned char)*str;
+
+		if (ch == '\n') {
+			if (x > maxx)
+				maxx = x;
+			x = sx;
+			y += f->h;
+			continue;
+		}
+
+		// Characters the font doesn't have are left blank
+		if (x < ctx->cx2 && y < ctx->cy2
+		    && x + f->w > ctx->cx1 && y + f->h > ctx->cy1) {
+			if (ch >= (unsigned)f->first && ch < (unsigned)(f->first + f->count))
+				glyph(ctx, &f->bits[(ch - f->first) * f->h], x, y, fg, bg,
+				      bg < 0);
+			else if (bg >= 0)
+				rcgl_ctx_fillrect(ctx, x, y, f->w, f->h, bg);
+		}
+		x += f->w;
+	}
+	if (x > maxx)
+		maxx = x;
+
+	if (ctx->dirtymode && maxx > sx)
+		damage(ctx, sx, top, maxx - sx, y + f->h - top);
+	return x;
+}
+
+/*
+ * glyph - Draw one character cell of the current font
+ * Each glyph row is turned into 8 pixels at once through glyphmask, columns
+ * past the 8th are background.
+ */
+static void glyph(rcgl_context *ctx, const uint8_t *rows, int x, int y,
+                  uint8_t fg, uint8_t bg, int trans)
+{
+	int w = ctx->font->w, h = ctx->font->h;
+	int r1 = (y < ctx->cy1) ? ctx->cy1 - y : 0;
+	int r2 = (y + h > ctx->cy2) ? ctx->cy2 - y : h;
+	int c1 = (x < ctx->cx1) ? ctx->cx1 - x : 0;
+	int c2 = (x + w > ctx->cx2) ? ctx->cx2 - x : w;
+	uint64_t fgv = 0x0101010101010101ull * fg;
+	uint64_t bgv = 0x0101010101010101ull * bg;
+	uint8_t *d = &ctx->buf[(y + r1) * ctx->bw + x];
+
+	for (int r = r1; r < r2; r++, d += ctx->bw) {
+		uint64_t m = glyphmask[rows[r]], v;
+
+		if (c1 == 0 && c2 >= 8) {
+			// Whole row visible, write it in one go
+			if (trans) {
+				memcpy(&v, d, 8);
+				v = (v & ~m) | (fgv & m);
+			}
+			else {
+				v = (fgv & m) | (bgv & ~m);
+			}
+			memcpy(d, &v, 8);
+			if (!trans && c2 > 8)
+				memset(d + 8, bg, c2 - 8);
+		}
+		else {
+			for (int c = c1; c < c2; c++) {
+				if (c < 8 && (rows[r] & (0x80 >> c)))
+					d[c] = fg;
+				else if (!trans)
+					d[c] = bg;
+			}
+		}
+	}
+}
+
+/*
+ * input - Record a keyboard or mouse event from the video thread
+ * Queues it for rcgl_pollevent and publishes the new state for rcgl_getinput
+ */
+static void input(rcgl_context *ctx, const SDL_Event *e)
+{
+	rcgl_event ev = { 0 };
+	int head;
+
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		ev.type = (e->type == SDL_KEYDOWN) ? RCGL_KEYDOWN : RCGL_KEYUP;
+		ev.code = e->key.keysym.scancode;
+		ev.x = ctx->instate.x;
+		ev.y = ctx->instate.y;
+		if (ev.code >= 0 && ev.code < RCGL_NUMKEYS)
+			ctx->instate.keys[ev.code] = (e->type == SDL_KEYDOWN);
+		break;
+	case SDL_MOUSEMOTION:
+		ev.type = RCGL_MOUSEMOVE;
+		ev.x = e->motion.x;
+		ev.y = e->motion.y;
+		mapmouse(ctx, &ev.x, &ev.y);
+		ctx->instate.x = ev.x;
+		ctx->instate.y = ev.y;
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		ev.type = (e->type == SDL_MOUSEBUTTONDOWN) ? RCGL_MOUSEDOWN
+		                                            : RCGL_MOUSEUP;
+		ev.code = e->button.button;
+		ev.x = e->button.x;
+		ev.y = e->button.y;
+		mapmouse(ctx, &ev.x, &ev.y);
+		ctx->instate.x = ev.x;
+		ctx->instate.y = ev.y;
+		if (ev.type == RCGL_MOUSEDOWN)
+			ctx->instate.buttons |= 1u << (ev.code - 1);
+		else
+			ctx->instate.buttons &= ~(1u << (ev.code - 1));
+		break;
+	case SDL_MOUSEWHEEL:
+		ev.type = RCGL_MOUSEWHEEL;
+		ev.x = e->wheel.x;
+		ev.y = e->wheel.y;
+		if (e->wheel.direction == SDL_MOUSEWHEEL_FLIPPED) {
+			ev.x = -ev.x;
+			ev.y = -ev.y;
+		}
+		ctx->instate.wheelx += ev.x;
+		ctx->instate.wheely += ev.y;
+		break;
+	default:
+		return;
+	}
+	ev.time = SDL_GetTicks();
+
+	// Queue the event, dropping it if the queue is full
+	head = SDL_AtomicGet(&ctx->evhead);
+	if ((unsigned)(head - SDL_AtomicGet(&ctx->evtail)) < EVQ) {
+		ctx->evq[head & (EVQ - 1)] = ev;
+		SDL_AtomicSet(&ctx->evhead, head + 1);
+	}
+
+	// Publish the new state, taking back whichever snapshot was spare
+	ctx->inbuf[ctx->inback] = ctx->instate;
+	ctx->inback = SDL_AtomicSet(&ctx->inmid, ctx->inback | 4) & 3;
+}
+
+/*
+ * mapmouse - Turn window coordinates into buffer coordinates
+ * Undoes the scaling from layout(). May be outside the buffer.
+ */
+static void mapmouse(rcgl_context *ctx, int *x, int *y)
+{
+	int ww, wh;
+
+	if (ctx->sdst.w == 0 || ctx->sdst.h == 0)
+		return;
+
+	// Window coordinates can differ from output pixels on high DPI displays
+	SDL_GetWindowSize(ctx->wind, &ww, &wh);
+	if (ww > 0 && wh > 0) {
+		*x = (int)((int64_t)*x * ctx->outw / ww);
+		*y = (int)((int64_t)*y * ctx->outh / wh);
+	}
+	*x = (int)-ceildiv(-(int64_t)(*x - ctx->sdst.x) * ctx->bw, ctx->sdst.w);
+	*y = (int)-ceildiv(-(int64_t)(*y - ctx->sdst.y) * ctx->bh, ctx->sdst.h);
+}
+
+/*
+ * timed - Add the time since start to a stage of the frame being drawn
+ */
+static void timed(rcgl_context *ctx, int stage, uint64_t start)
+{
+	if (ctx->ftimes[stage].dur == 0)
+		ctx->ftimes[stage].start = start;
+	ctx->ftimes[stage].dur += SDL_GetPerformanceCounter() - start;
+}
+
+/*
+ * applyvsync - Switch the renderer to a vsync mode, on the video thread
+ * The window surface can't wait for vsync, so there only OFF and FIXED mean
+ * anything.
+ */
+static void applyvsync(rcgl_context *ctx, int mode)
+{
+	SDL_RendererInfo info;
+
+	ctx->vsyncmode = mode;
+	ctx->pacedeadline = 0;
+	if (ctx->rend == NULL)
+		return;
+
+	SDL_RenderSetVSync(ctx->rend, mode == RCGL_VSYNC_ON
+	                         || mode == RCGL_VSYNC_ADAPTIVE);
+
+	// SDL's renderers only do on or off. Adaptive is the GL swap interval of
+	// -1, which works when the renderer is OpenGL and its context is current
+	// on this thread. Otherwise it stays as plain vsync.
+	if (mode == RCGL_VSYNC_ADAPTIVE
+	    && SDL_GetRendererInfo(ctx->rend, &info) == 0
+	    && strncmp(info.name, "opengl", 6) == 0)
+		SDL_GL_SetSwapInterval(-1);
+}
+
+/*
+ * pace - Wait for the next of hz evenly spaced deadlines
+ * Sleeps till SPINMS before the deadline then spins, as SDL_Delay can
+ * oversleep by a scheduler tick. If more than a frame late the deadlines
+ * restart from now rather than rushing to catch up. Returns the number of
+ * deadlines missed.
+ */
+static int pace(uint64_t *deadline, int hz)
+{
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	uint64_t period, now;
+	int missed = 0;
+
+	if (hz <= 0)
+		return 0;
+	period = freq / hz;
+	now = SDL_GetPerformanceCounter();
+	if (*deadline == 0)
+		*deadline = now;
+	if (now > *deadline + period) {
+		missed = (int)((now - *deadline) / period);
+		*deadline = now;
+	}
+
+	while ((now = SDL_GetPerformanceCounter()) < *deadline) {
+		uint64_t left = (*deadline - now) * 1000 / freq;
+		if (left > SPINMS)
+			SDL_Delay((uint32_t)(left - SPINMS));
+	}
+	*deadline += period;
+	return missed;
+}
+
+/*
+ * stagetime - Record how long a stage took, mutex must be held
+ */
+static void stagetime(rcgl_context *ctx, int stage, uint64_t start,
+                      uint64_t dur)
+{
+	struct STAGE *sg = &ctx->stages[stage];
+
+	sg->t[sg->next] = dur;
+	sg->next = (sg->next + 1) % STATWIN;
+	if (sg->n < STATWIN)
+		sg->n++;
+
+	if (!ctx->tracefile)
+		return;
+	if (ctx->ntrace == ctx->tracecap) {
+		int cap = ctx->tracecap ? ctx->tracecap * 2 : 4096;
+		struct TRACEEV *t = realloc(ctx->trace, cap * sizeof(*ctx->trace));
+		if (t == NULL)
+			return;
+		ctx->trace = t;
+		ctx->tracecap = cap;
+	}
+	ctx->trace[ctx->ntrace].start = start;
+	ctx->trace[ctx->ntrace].dur = dur;
+	ctx->trace[ctx->ntrace].stage = stage;
+	ctx->ntrace++;
+}
+
+/*
+ * commitstats - Record the stages of a frame that's just been shown
+ * mutex must be held
+ */
+static void commitstats(rcgl_context *ctx)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	for (int i = 0; i < RCGL_NUMSTAGES; i++)
+		if (ctx->ftimes[i].dur)
+			stagetime(ctx, i, ctx->ftimes[i].start, ctx->ftimes[i].dur);
+	if (ctx->lastpresent)
+		stagetime(ctx, RCGL_STAGE_FRAME, ctx->lastpresent,
+		          now - ctx->lastpresent);
+	ctx->lastpresent = now;
+	ctx->fshown++;
+}
+
+/*
+ * u64cmp - Sort 64-bit values
+ */
+static int u64cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * cmdadd - Add a command to a list, growing it if needed
+ */
+static struct CMD *cmdadd(rcgl_cmdlist *l, int type)
+{
+	if (l->n == l->cap) {
+		int cap = l->cap ? l->cap * 2 : 256;
+		struct CMD *c = realloc(l->cmds, cap * sizeof(struct CMD));
+		if (c == NULL) {
+			fprintf(stderr, "RCGL: Failed to grow command list\n");
+			return NULL;
+		}
+		l->cmds = c;
+		l->cap = cap;
+	}
+	l->cmds[l->n].type = type;
+	return &l->cmds[l->n++];
+}
+
+/*
+ * cmdbounds - Find the part of the clip rectangle a command can draw in
+ * Returns 0 if it's all clipped away.
+ */
+static int cmdbounds(rcgl_context *ctx, const struct CMD *c, SDL_Rect *r)
+{
+	int l, t, rt, b;
+
+	if (c->type == CMD_LINE) {
+		l = (c->x1 < c->x2) ? c->x1 : c->x2;
+		rt = (c->x1 < c->x2) ? c->x2 : c->x1;
+		t = (c->y1 < c->y2) ? c->y1 : c->y2;
+		b = (c->y1 < c->y2) ? c->y2 : c->y1;
+	}
+	else if (c->type == CMD_PLOT) {
+		l = rt = c->x1;
+		t = b = c->y1;
+	}
+	else {
+		l = c->x1;
+		t = c->y1;
+		rt = c->x1 + c->x2 - 1;
+		b = c->y1 + c->y2 - 1;
+	}
+
+	if (l < ctx->cx1) l = ctx->cx1;
+	if (t < ctx->cy1) t = ctx->cy1;
+	if (rt >= ctx->cx2) rt = ctx->cx2 - 1;
+	if (b >= ctx->cy2) b = ctx->cy2 - 1;
+	if (l > rt || t > b)
+		return 0;
+	r->x = l;
+	r->y = t;
+	r->w = rt - l + 1;
+	r->h = b - t + 1;
+	return 1;
+}
+
+/*
+ * cmdbands - Draw bands of the command list being run till none are left
+ * Each thread draws into its own target, so it can have its own clip
+ * rectangle. The damage has already been marked.
+ */
+static void cmdbands(void)
+{
+	struct TARGET dst = target(pool.ctx);
+	int b;
+
+	while ((b = SDL_AtomicAdd(&pool.next, 1)) < pool.bands)
+		cmdband(&dst, pool.cmds, b, pool.ctx->cy1, pool.ctx->cy2);
+}
+
+/*
+ * cmdband - Draw the commands in band b, clipped to it and cy1 to cy2
+ */
+static void cmdband(struct TARGET *dst, const rcgl_cmdlist *l, int b, int cy1,
+                    int cy2)
+{
+	dst->cy1 = (b * BAND > cy1) ? b * BAND : cy1;
+	dst->cy2 = (b * BAND + BAND < cy2) ? b * BAND + BAND : cy2;
+
+	for (int i = b ? l->bandend[b - 1] : 0; i < l->bandend[b]; i++)
+		cmddraw(dst, &l->cmds[l->bins[i]]);
+}
+
+/*
+ * cmddraw - Draw one recorded command, without marking damage
+ */
+static void cmddraw(const struct TARGET *dst, const struct CMD *c)
+{
+	switch (c->type) {
+	case CMD_PLOT:
+		if (c->x1 >= dst->cx1 && c->y1 >= dst->cy1 && c->x1 < dst->cx2
+		    && c->y1 < dst->cy2)
+			dst->buf[c->y1 * dst->bw + c->x1] = c->c;
+		break;
+	case CMD_LINE:
+		line(dst, c->x1, c->y1, c->x2, c->y2, c->c);
+		break;
+	case CMD_BLIT:
+		blitrect(dst, c->b, c->x2, c->x1, c->y1, c->x2, c->y2, 0, c->trans,
+		         c->plt);
+		break;
+	case CMD_SPRITE:
+		spritedraw(dst, c->b, c->x1, c->y1, c->plt);
+		break;
+	}
+}
+
+/*
+ * rundeferred - Run the command lists deferred to this update
+ */
+static void rundeferred(rcgl_context *ctx)
+{
+	while (ctx->deferred) {
+		rcgl_cmdlist *l = ctx->deferred;
+		ctx->deferred = l->next;
+		l->ctx = NULL;
+		rcgl_ctx_cmd_run(ctx, l);
+	}
+}
+
+/*
+ * cmdundefer - Take a list back off the deferred list it's on, if any
+ */
+static void cmdundefer(rcgl_cmdlist *l)
+{
+	rcgl_cmdlist **d;
+
+	if (l->ctx == NULL)
+		return;
+	for (d = &l->ctx->deferred; *d; d = &(*d)->next) {
+		if (*d == l) {
+			*d = l->next;
+			break;
+		}
+	}
+	l->ctx = NULL;
+}
+
+/*
+ * present - Show the rendered frame, rects are the regions that changed
+ */
+static void present(rcgl_context *ctx, const SDL_Rect *rects, int nrects)
+{
+	uint64_t t = SDL_GetPerformanceCounter();
+
+	if (ctx->surfmode) {
+		SDL_Rect r[MAXDIRTY];
+
+		// Window surface keeps its contents, nothing to do if nothing changed
+		if (nrects == 0)
+			return;
+		if (ctx->ssurf) {
+			SDL_BlitScaled(ctx->ssurf, NULL, ctx->wsurf, &ctx->sdst);
+			SDL_UpdateWindowSurfaceRects(ctx->wind, &ctx->sdst, 1);
+			timed(ctx, RCGL_STAGE_PRESENT, t);
+			return;
+		}
+		for (int i = 0; i < nrects && i < MAXDIRTY; i++) {
+			r[i] = scalerect(ctx, &rects[i]);
+			r[i].x += ctx->sdst.x;
+			r[i].y += ctx->sdst.y;
+		}
+		SDL_UpdateWindowSurfaceRects(ctx->wind, r, nrects);
+		timed(ctx, RCGL_STAGE_PRESENT, t);
+		return;
+	}
+
+	SDL_SetRenderDrawColor(ctx->rend, 0, 0, 0, 0);
+	SDL_RenderClear(ctx->rend);
+	// Renderer does whatever scaling is left
+	SDL_RenderCopy(ctx->rend, ctx->tx, NULL, &ctx->sdst);
+	timed(ctx, RCGL_STAGE_COPY, t);
+	t = SDL_GetPerformanceCounter();
+	SDL_RenderPresent(ctx->rend);              // Do update
+	timed(ctx, RCGL_STAGE_PRESENT, t);
+}
+
+/*
+ * surfaceinit - Set up presenting through the window surface
+ */
+static int surfaceinit(rcgl_context *ctx)
+{
+	ctx->isurf = SDL_CreateRGBSurfaceWithFormatFrom(NULL, ctx->bw,
+	                                                ctx->bh, 8, ctx->bw,
+	                                                SDL_PIXELFORMAT_INDEX8);
+	if (ctx->isurf == NULL) {
+		fprintf(stderr, "RCGL: Failed to create Surface: %s\n",
+		        SDL_GetError());
+		return -1;
+	}
+	// Palette is filled in on the first render
+	memset(ctx->plut, 0, sizeof(ctx->plut));
+	return 0;
+}
+
+/*
+ * surfacepal - Give SDL's 8-bit blitter the palette snapshot
+ */
+static void surfacepal(rcgl_context *ctx)
+{
+	SDL_Color cols[256];
+
+	for (int i = 0; i < 256; i++) {
+		cols[i].r = ctx->plut[i] >> 16;
+		cols[i].g = ctx->plut[i] >> 8;
+		cols[i].b = ctx->plut[i];
+		cols[i].a = 0xFF;
+	}
+	SDL_SetPaletteColors(ctx->isurf->format->palette, cols, 0, 256);
+}
+
+/*
+ * surfacefree - Free surfaces used for presenting through the window surface
+ */
+static void surfacefree(rcgl_context *ctx)
+{
+	if (ctx->ssurf)
+		SDL_FreeSurface(ctx->ssurf);
+	if (ctx->isurf)
+		SDL_FreeSurface(ctx->isurf);
+	ctx->ssurf = ctx->isurf = NULL;
+	ctx->wsurf = NULL;
+}
+
+/*
+ * layout - Fit the frame to the window, and pick how it gets scaled
+ * Needs calling whenever the window changes size. Fits the same way as
+ * SDL_RenderSetLogicalSize, stretched to the aspect from rcgl_setscale, and
+ * leaves the window black around the frame. Returns 1 if the output was
+ * remade and the whole frame needs converting again, 0 if not, or -1 on
+ * error.
+ */
+static int layout(rcgl_context *ctx)
+{
+	int mode = ctx->scalemode;
+	int ow, oh, tw, th, sharp;
+	float fw = ctx->bw, fh = ctx->bh, sc;
+
+	// Output size, which can differ from the window's on high DPI displays
+	if (ctx->surfmode) {
+		if ((ctx->wsurf = SDL_GetWindowSurface(ctx->wind)) == NULL) {
+			fprintf(stderr, "RCGL: Failed to get window surface: %s\n",
+			        SDL_GetError());
+			return -1;
+		}
+		ow = ctx->wsurf->w;
+		oh = ctx->wsurf->h;
+	}
+	else if (SDL_GetRendererOutputSize(ctx->rend, &ow, &oh) < 0) {
+		fprintf(stderr, "RCGL: Failed to get output size: %s\n",
+		        SDL_GetError());
+		return -1;
+	}
+	ctx->outw = ow;
+	ctx->outh = oh;
+
+	// Non-square pixels only ever stretch the frame, never shrink it
+	if (ctx->aspw > 0) {
+		if ((int64_t)ctx->aspw * ctx->bh > (int64_t)ctx->asph * ctx->bw)
+			fw = fh * ctx->aspw / ctx->asph;
+		else
+			fh = fw * ctx->asph / ctx->aspw;
+	}
+	sc = ow / fw;
+	if (oh / fh < sc)
+		sc = oh / fh;
+	if ((ctx->cargs.wflags & RCGL_INTSCALE) && sc >= 1)
+		sc = (float)(int)sc;
+	ctx->sdst.w = (int)(fw * sc);
+	ctx->sdst.h = (int)(fh * sc);
+	ctx->sdst.x = (ow - ctx->sdst.w) / 2;
+	ctx->sdst.y = (oh - ctx->sdst.h) / 2;
+
+	// Renderers scale for next to nothing, SDL's blitter doesn't
+	if (mode == RCGL_SCALE_AUTO)
+		mode = ctx->surfmode ? RCGL_SCALE_INTEGER : RCGL_SCALE_RENDERER;
+
+	if (ctx->surfmode) {
+		uint32_t fmt = ctx->wsurf->format->format;
+
+		SDL_FillRect(ctx->wsurf, NULL, 0);
+		if (ctx->ssurf)
+			SDL_FreeSurface(ctx->ssurf);
+		ctx->ssurf = NULL;
+
+		// Scaled by us while converting, straight into the window, when
+		// it's a format plut is already in. Smoothing is too slow here so
+		// sharp is the same as integer.
+		ctx->direct = mode != RCGL_SCALE_RENDERER
+		              && (fmt == SDL_PIXELFORMAT_ARGB8888
+		                  || fmt == SDL_PIXELFORMAT_RGB888);
+		if (ctx->direct) {
+			scaletables(ctx, ctx->sdst.w, ctx->sdst.h);
+			return 1;
+		}
+
+		// Otherwise unscaled frames go straight to the window, scaled ones
+		// are converted first then stretched
+		scaletables(ctx, ctx->bw, ctx->bh);
+		surfacepal(ctx);
+		if (ctx->sdst.w != ctx->bw || ctx->sdst.h != ctx->bh) {
+			ctx->ssurf = SDL_CreateRGBSurfaceWithFormat(0, ctx->bw, ctx->bh,
+			                                            32, fmt);
+			if (ctx->ssurf == NULL) {
+				fprintf(stderr, "RCGL: Failed to create Surface: %s\n",
+				        SDL_GetError());
+				return -1;
+			}
+		}
+		return 1;
+	}
+
+	// The texture is expanded by whole pixels to as close under the window
+	// size as it gets, then the renderer does the rest
+	tw = ctx->bw;
+	th = ctx->bh;
+	if (mode != RCGL_SCALE_RENDERER) {
+		if (ctx->sdst.w > ctx->bw)
+			tw *= ctx->sdst.w / ctx->bw;
+		if (ctx->sdst.h > ctx->bh)
+			th *= ctx->sdst.h / ctx->bh;
+	}
+	sharp = mode == RCGL_SCALE_SHARP;
+	scaletables(ctx, tw, th);
+	if (ctx->tx && tw == ctx->txw && th == ctx->txh && sharp == ctx->txsharp)
+		return 0;
+
+	// Textures take the scale quality from when they're created
+	if (ctx->tx)
+		SDL_DestroyTexture(ctx->tx);
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, sharp ? "linear" : "nearest");
+	ctx->tx = SDL_CreateTexture(ctx->rend,
+	                            SDL_PIXELFORMAT_ARGB8888,
+	                            SDL_TEXTUREACCESS_STREAMING,
+	                            tw,
+	                            th);
+	if (ctx->tx == NULL) {
+		fprintf(stderr, "RCGL: Failed to create Texture: %s\n",
+		        SDL_GetError());
+		return -1;
+	}
+	ctx->txw = tw;
+	ctx->txh = th;
+	ctx->txsharp = sharp;
+	return 1;
+}
+
+/*
+ * refresh - Lay out a window again and redraw its last frame
+ * Done for any window event. The window surface always needs redrawing,
+ * a texture only once it's been remade. The last frame is read under mutex,
+ * so it can't go away part way through, and is left blank if it already has.
+ */
+static void refresh(rcgl_context *ctx)
+{
+	SDL_Rect all = { 0, 0, ctx->bw, ctx->bh };
+	int remade = layout(ctx);
+
+	if (remade < 0)
+		return;
+	SDL_LockMutex(ctx->mutex);
+	if (ctx->lastsrc && ctx->surfmode && !ctx->direct) {
+		SDL_Rect d = ctx->sdst;
+		ctx->isurf->pixels = (void *)composited(ctx, ctx->lastsrc, &all, 1);
+		SDL_BlitSurface(ctx->isurf, NULL,
+		                ctx->ssurf ? ctx->ssurf : ctx->wsurf,
+		                ctx->ssurf ? NULL : &d);
+		ctx->isurf->pixels = NULL;
+	}
+	else if (ctx->lastsrc && remade)
+		convert(ctx, ctx->lastsrc, &all);
+	SDL_UnlockMutex(ctx->mutex);
+	present(ctx, &all, 1);
+}
+
+/*
+ * damage - Add a region to the dirty rectangle list
+ */
+static void damage(rcgl_context *ctx, int x, int y, int w, int h)
+{
+	damagelist(ctx, ctx->dirty, &ctx->ndirty, x, y, w, h);
+}
+
+/*
+ * clipdamage - Mark the part of a region inside the clip rectangle as changed
+ */
+static void clipdamage(rcgl_context *ctx, int x, int y, int w, int h)
+{
+	int x2 = x + w, y2 = y + h;
+
+	if (x < ctx->cx1) x = ctx->cx1;
+	if (y < ctx->cy1) y = ctx->cy1;
+	if (x2 > ctx->cx2) x2 = ctx->cx2;
+	if (y2 > ctx->cy2) y2 = ctx->cy2;
+	if (x < x2 && y < y2)
+		damage(ctx, x, y, x2 - x, y2 - y);
+}
+
+/*
+ * target - Where drawing through ctx lands, clipped to its clip rectangle
+ */
+static struct TARGET target(const rcgl_context *ctx)
+{
+	struct TARGET t;
+
+	t.buf = ctx->buf;
+	t.bw = ctx->bw;
+	t.bh = ctx->bh;
+	t.cx1 = ctx->cx1;
+	t.cy1 = ctx->cy1;
+	t.cx2 = ctx->cx2;
+	t.cy2 = ctx->cy2;
+	return t;
+}
+
+/*
+ * handoffdamage - Move damage since the last update over to the video thread
+ * Anything not picked up yet from a dropped frame is kept. Call with mutex held.
+ */
+static void handoffdamage(rcgl_context *ctx)
+{
+	if (!ctx->dirtymode) {
+		ctx->ndirty = 0;
+		damage(ctx, 0, 0, ctx->bw, ctx->bh);
+	}
+	for (int i = 0; i < ctx->ndirty; i++)
+		damagelist(ctx, ctx->udirty, &ctx->nudirty,
+		           ctx->dirty[i].x, ctx->dirty[i].y,
+		           ctx->dirty[i].w, ctx->dirty[i].h);
+	ctx->ndirty = 0;
+}
+
+/*
+ * nextframe - Allocate the next frame id, never 0. Call with mutex held.
+ */
+static uint32_t nextframe(rcgl_context *ctx)
+{
+	if (++ctx->fsubmitted == 0)
+		++ctx->fsubmitted;
+	return ctx->fsubmitted;
+}
+
+/*
+ * capture - Queue a copy of a frame for the capture writer
+ * Layers showing behind the buffer are composited into the copy, so it
+ * holds what's seen. Dropped and counted if the writer hasn't caught up yet.
+ */
+static void capture(rcgl_context *ctx, const uint8_t *src, const uint32_t *pal)
+{
+	struct CAPFRAME *f;
+
+	SDL_LockMutex(ctx->capmutex);
+	if (ctx->capcount == CAPFRAMES) {
+		SDL_UnlockMutex(ctx->capmutex);
+		SDL_AtomicAdd(&ctx->capdropped, 1);
+		return;
+	}
+	f = &ctx->capq[(ctx->caphead + ctx->capcount) % CAPFRAMES];
+	SDL_UnlockMutex(ctx->capmutex);
+
+	// Slot isn't touched by the writer till it's counted in the queue
+	if (ctx->layers.n > 0 && ctx->layers.key >= 0)
+		for (int y = 0; y < ctx->bh; y++) {
+			size_t o = (size_t)y * ctx->bw;
+			composite(&ctx->layers, f->pix + o, src + o, 0, y, ctx->bw);
+		}
+	else
+		memcpy(f->pix, src, (size_t)ctx->bw * ctx->bh);
+	f->palchanged = !ctx->caphaspal
+	                || memcmp(ctx->caplastpal, pal, sizeof(ctx->caplastpal));
+	if (f->palchanged) {
+		memcpy(ctx->caplastpal, pal, sizeof(ctx->caplastpal));
+		memcpy(f->pal, pal, sizeof(f->pal));
+		ctx->caphaspal = 1;
+	}
+	f->ticks = SDL_GetTicks();
+
+	SDL_LockMutex(ctx->capmutex);
+	ctx->capcount++;
+	SDL_CondSignal(ctx->capcond);
+	SDL_UnlockMutex(ctx->capmutex);
+}
+
+/*
+ * Capture writer
+ *
+ * Streams queued frames to capfile as records:
+ *   'P' followed by 256 palette entries
+ *   'F' followed by the ticks and w*h palette indices
+ */
+static int capthread(void *data)
+{
+	rcgl_context *ctx = data;
+	size_t size = (size_t)ctx->bw * ctx->bh;
+	struct CAPFRAME *f;
+
+	for (;;) {
+		SDL_LockMutex(ctx->capmutex);
+		while (ctx->capcount == 0 && !ctx->capstop)
+			SDL_CondWait(ctx->capcond, ctx->capmutex);
+		if (ctx->capcount == 0) {
+			SDL_UnlockMutex(ctx->capmutex);
+			break;
+		}
+		f = &ctx->capq[ctx->caphead];
+		SDL_UnlockMutex(ctx->capmutex);
+
+		if (f->palchanged) {
+			fputc('P', ctx->capfile);
+			for (int i = 0; i < 256; i++)
+				put32(ctx->capfile, f->pal[i]);
+		}
+		fputc('F', ctx->capfile);
+		put32(ctx->capfile, f->ticks);
+		if (fwrite(f->pix, 1, size, ctx->capfile) != size)
+			ctx->caperror = 1;
+
+		SDL_LockMutex(ctx->capmutex);
+		ctx->caphead = (ctx->caphead + 1) % CAPFRAMES;
+		ctx->capcount--;
+		SDL_UnlockMutex(ctx->capmutex);
+	}
+	if (fflush(ctx->capfile) != 0)
+		ctx->caperror = 1;
+	return 0;
+}
+
+/*
+ * put32 - Write a little-endian 32-bit value
+ */
+static void put32(FILE *f, uint32_t v)
+{
+	uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	fwrite(b, 1, 4, f);
+}
+
+/*
+ * get32 - Read a little-endian 32-bit value, returns non-zero at end of file
+ */
+static int get32(FILE *f, uint32_t *v)
+{
+	uint8_t b[4];
+
+	if (fread(b, 1, 4, f) != 4)
+		return -1;
+	*v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+	return 0;
+}
+
+/*
+ * pngpattern - Check a PNG file name pattern takes just the frame number
+ * Allows one %d or %i, with flags and a width, and any number of %%.
+ * Returns -1 if handing it to snprintf with an int could go wrong.
+ */
+static int pngpattern(const char *out)
+{
+	int n = 0;
+
+	for (const char *c = out; *c; c++) {
+		if (*c != '%')
+			continue;
+		if (*++c == '%')
+			continue;
+		while (*c && strchr("-+ #0", *c))
+			c++;
+		while (*c >= '0' && *c <= '9')
+			c++;
+		if (*c != 'd' && *c != 'i')
+			return -1;
+		n++;
+	}
+	return n == 1 ? 0 : -1;
+}
+
+/*
+ * pngput - Write bytes of a PNG chunk, keeping its running CRC
+ */
+static void pngput(FILE *f, const void *d, size_t n, uint32_t *crc)
+{
+	static uint32_t table[256];
+	const uint8_t *p = d;
+
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	fwrite(d, 1, n, f);
+	for (size_t i = 0; i < n; i++)
+		*crc = table[(*crc ^ p[i]) & 0xFF] ^ (*crc >> 8);
+}
+
+/*
+ * pngchunk - Start a PNG chunk of len bytes, returns the initial CRC
+ */
+static uint32_t pngchunk(FILE *f, const char *type, uint32_t len)
+{
+	uint8_t b[4] = { len >> 24, len >> 16, len >> 8, len };
+	uint32_t crc = 0xFFFFFFFF;
+
+	fwrite(b, 1, 4, f);
+	pngput(f, type, 4, &crc);
+	return crc;
+}
 
-	rval = drawstatus;
-	SDL_UnlockMutex(mutex);
+/*
+ * pngend - Finish a PNG chunk with its CRC
+ */
+static void pngend(FILE *f, uint32_t crc)
+{
+	uint8_t b[4];
 
-	return rval;
+	crc ^= 0xFFFFFFFF;
+	b[0] = crc >> 24; b[1] = crc >> 16; b[2] = crc >> 8; b[3] = crc;
+	fwrite(b, 1, 4, f);
 }
 
 /*
- * rcgl_setbuf - Change buffer to b
- * If b is NULL, set buffer to internal buffer
+ * writepng - Write an 8-bit indexed image as a PNG
+ * Image data is stored uncompressed, so no zlib is needed
  */
-void rcgl_setbuf(uint8_t *b)
+static int writepng(const char *name, const uint8_t *src, uint32_t w,
+                    uint32_t h, const uint32_t *pal)
 {
-	if (b)
-		buf = b;
-	else
-		buf = ibuf;
+	FILE *f;
+	uint32_t crc;
+	uint32_t a = 1, b = 0;                 // Adler-32 of the image data
+	uint32_t left = (w + 1) * h;           // Filter byte + pixels per row
+	uint32_t blocks = (left + 65534) / 65535;
+	uint32_t x = 0, y = 0;
+	uint8_t hdr[13] = { w >> 24, w >> 16, w >> 8, w,
+	                    h >> 24, h >> 16, h >> 8, h,
+	                    8, 3, 0, 0, 0 };   // 8-bit, indexed colour
+
+	if ((f = fopen(name, "wb")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to open %s\n", name);
+		return -1;
+	}
+	fwrite("\x89PNG\r\n\x1A\n", 1, 8, f);
+
+	crc = pngchunk(f, "IHDR", 13);
+	pngput(f, hdr, 13, &crc);
+	pngend(f, crc);
+
+	crc = pngchunk(f, "PLTE", 256 * 3);
+	for (int i = 0; i < 256; i++) {
+		uint8_t rgb[3] = { pal[i] >> 16, pal[i] >> 8, pal[i] };
+		pngput(f, rgb, 3, &crc);
+	}
+	pngend(f, crc);
+
+	// zlib stream made of stored deflate blocks
+	crc = pngchunk(f, "IDAT", 2 + blocks * 5 + left + 4);
+	pngput(f, "\x78\x01", 2, &crc);
+	while (left > 0) {
+		uint32_t n = (left > 65535) ? 65535 : left;
+		uint8_t blk[5] = { left == n, n, n >> 8, ~n, ~n >> 8 };
+
+		pngput(f, blk, 5, &crc);
+		left -= n;
+		while (n > 0) {
+			// Emit the row's filter byte or as much of the row as fits
+			const uint8_t *p = (x == 0) ? (const uint8_t *)"" : src + y*w + x-1;
+			uint32_t c = (x == 0) ? 1 : (w + 1 - x < n) ? w + 1 - x : n;
+
+			pngput(f, p, c, &crc);
+			for (uint32_t i = 0; i < c; i++) {
+				a = (a + p[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			n -= c;
+			x += c;
+			if (x == w + 1) {
+				x = 0;
+				y++;
+			}
+		}
+	}
+	b = (b << 16) | a;
+	{
+		uint8_t ad[4] = { b >> 24, b >> 16, b >> 8, b };
+		pngput(f, ad, 4, &crc);
+	}
+	pngend(f, crc);
+
+	crc = pngchunk(f, "IEND", 0);
+	pngend(f, crc);
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "RCGL: Failed writing %s\n", name);
+		return -1;
+	}
+	return 0;
 }
 
 /*
- * rcgl_getbuf - Get pointer to the current buffer
+ * damagelist - Add a region to a list of up to MAXDIRTY rectangles
+ * Overlapping or touching regions are coalesced, and once the list is full
+ * the region is merged into whichever entry grows the least.
  */
-uint8_t *rcgl_getbuf(void)
+static void damagelist(rcgl_context *ctx, SDL_Rect *list, int *n, int x, int y,
+                       int w, int h)
 {
-	return buf;
+	int x2, y2;
+	int best, bestgrow;
+
+	// Clip to the buffer
+	x2 = x + w;
+	y2 = y + h;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x2 > ctx->bw) x2 = ctx->bw;
+	if (y2 > ctx->bh) y2 = ctx->bh;
+	if (x >= x2 || y >= y2)
+		return;
+
+	for (;;) {
+		best = -1;
+		bestgrow = 0;
+		for (int i = 0; i < *n; i++) {
+			SDL_Rect *d = &list[i];
+			int ux = (x < d->x) ? x : d->x;
+			int uy = (y < d->y) ? y : d->y;
+			int ux2 = (x2 > d->x + d->w) ? x2 : d->x + d->w;
+			int uy2 = (y2 > d->y + d->h) ? y2 : d->y + d->h;
+			int grow = (ux2 - ux) * (uy2 - uy)
+			         - (x2 - x) * (y2 - y) - d->w * d->h;
+
+			if (ux == d->x && uy == d->y &&
+			    ux2 == d->x + d->w && uy2 == d->y + d->h)
+				return; // Already covered
+
+			if (best < 0 || grow < bestgrow) {
+				best = i;
+				bestgrow = grow;
+			}
+		}
+		// Merge when nothing is gained by keeping them apart, or when full
+		if (best < 0 || (bestgrow > 0 && *n < MAXDIRTY))
+			break;
+
+		// Pull the entry out and retry with the union, it may now touch others
+		SDL_Rect d = list[best];
+		list[best] = list[--*n];
+		if (d.x < x) x = d.x;
+		if (d.y < y) y = d.y;
+		if (d.x + d.w > x2) x2 = d.x + d.w;
+		if (d.y + d.h > y2) y2 = d.y + d.h;
+	}
+
+	list[*n].x = x;
+	list[*n].y = y;
+	list[*n].w = x2 - x;
+	list[*n].h = y2 - y;
+	(*n)++;
 }
 
 /*
- * rcgl_hasquit - Test if program has quit
+ * pblit - blit() split into bands of rows across the worker threads
  */
-int rcgl_hasquit(void)
+static void pblit(rcgl_context *ctx, const uint8_t *src, uint8_t *dst,
+                  int pitch, const SDL_Rect *r)
 {
-	return SDL_AtomicGet(&status) == 0;
+	// The workers are shared, if another context has them convert alone
+	if (r->w * r->h < POOLMIN || !pooltake()) {
+		blit(ctx, src, dst, pitch, r);
+		return;
+	}
+
+	// A few bands per thread evens out any thread that's slow to start
+	pool.ctx = ctx;
+	pool.src = src;
+	pool.dst = dst;
+	pool.pitch = pitch;
+	pool.r = r;
+	pool.bands = (pool.n + 1) * 4;
+	if (pool.bands > r->h)
+		pool.bands = r->h;
+	poolrun(poolbands);
 }
 
 /*
- * rcgl_delay - Delay for ms milliseconds
+ * poolbands - Convert bands of the current job till none are left
  */
-void rcgl_delay(uint32_t ms)
+static void poolbands(void)
 {
-	SDL_Delay(ms);
+	const SDL_Rect *r = pool.r;
+	int b;
+
+	while ((b = SDL_AtomicAdd(&pool.next, 1)) < pool.bands) {
+		SDL_Rect band = *r;
+		int y1 = r->h * b / pool.bands;
+		int y2 = r->h * (b + 1) / pool.bands;
+
+		band.y = r->y + y1;
+		band.h = y2 - y1;
+		blit(pool.ctx, pool.src,
+		     pool.dst + (pool.ctx->ypos[band.y] - pool.ctx->ypos[r->y])
+		                * pool.pitch, pool.pitch, &band);
+	}
 }
 
 /*
- * rcgl_ticks - Return number of milliseconds since start
+ * pooltake - Take the workers for a job
+ * They're started or stopped first if the thread count has been changed.
+ * Returns 0 without them if another context has them, or there are none.
  */
-uint32_t rcgl_ticks(void)
+static int pooltake(void)
 {
-	return SDL_GetTicks();
+	if (!SDL_AtomicTryLock(&pool.lock))
+		return 0;
+	if (SDL_AtomicGet(&wantthreads) != pool.n)
+		poolresize(SDL_AtomicGet(&wantthreads));
+	if (pool.n == 0) {
+		SDL_AtomicUnlock(&pool.lock);
+		return 0;
+	}
+	return 1;
 }
 
 /*
- * rcgl_plot - Plot a pixel at x,y with colour c
+ * poolrun - Run job on every worker and this thread, then give them back
+ * The job takes bands from pool.next till pool.bands are done.
  */
-void rcgl_plot(int x, int y, uint8_t c)
+static void poolrun(void (*job)(void))
 {
-	buf[y * bw + x] = c;
+	pool.job = job;
+	SDL_AtomicSet(&pool.next, 0);
+	for (int i = 0; i < pool.n; i++)
+		SDL_SemPost(pool.start);
+	job();
+	for (int i = 0; i < pool.n; i++)
+		SDL_SemWait(pool.done);
+	SDL_AtomicUnlock(&pool.lock);
 }
 
 /*
- * rcgl_setpalette - Copy an entire palette definition into the current palette
+ * Worker, sharing palette conversion and command lists with the caller
  */
-void rcgl_setpalette(const uint32_t palette[256])
+static int poolthread(void *data)
 {
-	for (int i = 0; i < 256; i++)
-		rcgl_palette[i] = palette[i];
+	(void)data;
+	for (;;) {
+		SDL_SemWait(pool.start);
+		if (pool.quit)
+			break;
+		pool.job();
+		SDL_SemPost(pool.done);
+	}
+	return 0;
 }
 
 /*
- * rcgl_line - Draw a line between two points
+ * poolresize - Replace the workers with n new ones, 0 stops them all
+ * Call with pool.lock held.
  */
-void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
+static void poolresize(int n)
 {
-	// Bresenham's line drawing algorithm
-	int dx, dy;
-	int adx, ady;
-	int x, y;
-	int sdx, sdy;
-	int ex, ey;
-
-	dx = x2 - x1;
-	dy = y2 - y1;
-
-	// With the abs we can pretend to only be in octant 1 or 0
-	adx = abs(dx);
-	ady = abs(dy);
-
-	// Figure out the actual octant for the line
-	sdx = (dx > 0) ? 1 : (dx < 0) ? -1 : 0;
-	sdy = (dy > 0) ? 1 : (dy < 0) ? -1 : 0;
-
-	x = x1;
-	y = y1;
-
-	ex = 0;
-	ey = 0;
-
-	if (adx >= ady) { // Octant 0 (y rises slower than x)
-		for (int i = 0; i <= adx; i++) {
-			rcgl_plot(x, y, c);
-
-			ey += ady;
-			if (ey >= adx) { // If we're past the increment point of y
-				ey -= adx;   // Reset, but propogate error
-				y += sdy;
-			}
-			x += sdx;
-		}
+	if (pool.n) {
+		pool.quit = 1;
+		for (int i = 0; i < pool.n; i++)
+			SDL_SemPost(pool.start);
+		for (int i = 0; i < pool.n; i++)
+			SDL_WaitThread(pool.thr[i], NULL);
+		SDL_DestroySemaphore(pool.start);
+		SDL_DestroySemaphore(pool.done);
+		pool.n = 0;
 	}
-	else { // Octant 1 (x rises slower than y)
-		for (int i = 0; i <= ady; i++) {
-			rcgl_plot(x, y, c);
+	pool.quit = 0;
+	if (n <= 0)
+		return;
 
-			ex += adx;
-			if (ex >= ady) { // If we're past the increment point of x
-				ex -= ady;   // Reset, but propogate error
-				x += sdx;
-			}
-			y += sdy;
-		}
+	pool.start = SDL_CreateSemaphore(0);
+	pool.done = SDL_CreateSemaphore(0);
+	if (pool.start == NULL || pool.done == NULL)
+		goto failsem;
+	for (pool.n = 0; pool.n < n; pool.n++) {
+		pool.thr[pool.n] = SDL_CreateThread(poolthread, "RCGLWorker", NULL);
+		if (pool.thr[pool.n] == NULL)
+			break;
 	}
+	if (pool.n < n) {
+		fprintf(stderr, "RCGL: Only started %d of %d worker threads: %s\n",
+		        pool.n, n, SDL_GetError());
+		SDL_AtomicSet(&wantthreads, pool.n);
+	}
+	if (pool.n > 0)
+		return;
+failsem:
+	if (pool.start)
+		SDL_DestroySemaphore(pool.start);
+	if (pool.done)
+		SDL_DestroySemaphore(pool.done);
+	pool.start = pool.done = NULL;
+	// Don't keep retrying every frame
+	SDL_AtomicSet(&wantthreads, 0);
 }
 
 /*
- * rcgl_blit - Blit a bitmap somewhere onto the framebuffer
+ * blitrow_c - Portable palette expansion of n pixels
  */
-void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt)
+static void blitrow_c(const uint8_t *src, uint32_t *dst, int n,
+                      const uint32_t *lut)
 {
-	uint8_t *fb = buf + (y * bw) + x;
+	int x = 0;
 
-	if (plt != NULL) {
-		for (int r = 0; r < h; r++) {
-			for (int c = 0; c < w; c++) {
-				if (trans < 0 || plt[*b] != trans)
-					*fb = plt[*b];
-				b++;
-				fb++;
-			}
-			fb += bw-w;
-		}
-	}
-	else {
-		for (int r = 0; r < h; r++) {
-			for (int c = 0; c < w; c++) {
-				if (trans < 0 || *b != trans)
-					*fb = *b;
-				b++;
-				fb++;
-			}
-			fb += bw-w;
-		}
+	for (; x + 4 <= n; x += 4) {
+		dst[x+0] = lut[src[x+0]];
+		dst[x+1] = lut[src[x+1]];
+		dst[x+2] = lut[src[x+2]];
+		dst[x+3] = lut[src[x+3]];
 	}
+	for (; x < n; x++)
+		dst[x] = lut[src[x]];
 }
 
-
-/* INTERNAL LIBRARY HELPER ROUTINES */
-
+#ifdef RCGL_HAVE_AVX2
 /*
- * blit - Render 8-bit bitmap to 32-bit bitmap using palette
+ * blitrow_avx2 - Palette expansion of n pixels using AVX2 gathers
+ * 16 pixels per iteration, remainder is handled by the portable routine
  */
-static void blit(uint8_t *src, uint32_t *dst)
+RCGL_TARGET_AVX2
+static void blitrow_avx2(const uint8_t *src, uint32_t *dst, int n,
+                         const uint32_t *lut)
 {
-	for (int y = 0; y < bh; y++)
-		for (int x = 0; x < bw; x++)
-			*(dst++) = rcgl_palette[*(src++)] | 0xFF000000;
+	int x = 0;
+
+	for (; x + 16 <= n; x += 16) {
+		__m128i idx = _mm_loadu_si128((const __m128i *)(src + x));
+		__m256i lo = _mm256_cvtepu8_epi32(idx);
+		__m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8));
+
+		lo = _mm256_i32gather_epi32((const int *)lut, lo, 4);
+		hi = _mm256_i32gather_epi32((const int *)lut, hi, 4);
+		_mm256_storeu_si256((__m256i *)(dst + x), lo);
+		_mm256_storeu_si256((__m256i *)(dst + x + 8), hi);
+	}
+	if (x < n)
+		blitrow_c(src + x, dst + x, n - x, lut);
 }
+#endif
 
 /*
- * Background and screen update handler
+ * Background and screen update handler, shared by every window
  *
  * NOTE: This is the only thread allowed to call WaitEvent/PollEvent/PumpEvents
  * Though to do so we need to move the SDL init code here :/
+ * Started with the first window's context, which is created straight away.
  */
 static int videothread(void *data)
 {
-	int rval;
 	SDL_Event event;
-	int pitch;
-	void *rbuf;
-	int dstatus;
+	int running;
 
 	/* Video initialization */
 	SDL_Init(SDL_INIT_VIDEO);
-	wind = SDL_CreateWindow(cargs.title,
-	           SDL_WINDOWPOS_UNDEFINED,
-	           SDL_WINDOWPOS_UNDEFINED,
-	           cargs.ww,
-	           cargs.wh,
-	           ((cargs.wflags&RCGL_RESIZE)?SDL_WINDOW_RESIZABLE:0)
-	           | ((cargs.wflags&RCGL_FULLSCREEN)?SDL_WINDOW_FULLSCREEN:0)
-	           | ((cargs.wflags&RCGL_MAXIMIZED)?SDL_WINDOW_MAXIMIZED:0)
-	           | ((cargs.wflags&RCGL_FULLSCREEN_NATIVE)?SDL_WINDOW_FULLSCREEN_DESKTOP:0)
-	           | SDL_WINDOW_ALLOW_HIGHDPI);
-	if (wind == NULL) {
-		fprintf(stderr, "RCGL: Failed to create Window: %s\n",
-		        SDL_GetError());
-		rval = -4;
-		goto failwind;
-	}
-	
-	rend = SDL_CreateRenderer(wind, -1, 0);
-	if (rend == NULL) {
-		fprintf(stderr, "RCGL: Failed to create Renderer: %s\n",
-		        SDL_GetError());
-		rval = -4;
-		goto failrend;
-	}
-	SDL_RenderSetLogicalSize(rend, cargs.w, cargs.h);
-	SDL_RenderSetIntegerScale(rend, cargs.wflags & RCGL_INTSCALE);
-	
-	tx = SDL_CreateTexture(rend,
-	                       SDL_PIXELFORMAT_ARGB8888,
-	                       SDL_TEXTUREACCESS_STREAMING,
-	                       cargs.w,
-	                       cargs.h);
-	if (tx == NULL) {
-		fprintf(stderr, "RCGL: Failed to create Texture: %s\n",
-		        SDL_GetError());
-		rval = -4;
-		goto failtx;
-	}
-
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, 0);
-	SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-	SDL_RenderClear(rend);
-	SDL_GL_SetSwapInterval(1);
-
-	// Clear initial window
-	SDL_SetRenderDrawColor(rend, 0, 0, 0, 255);
-	SDL_RenderClear(rend);
-	SDL_RenderPresent(rend);              // Do update
-
-	SDL_AtomicSet(&status, 1);
+	windowinit(data);
 
-	// Signal to parent thread that initialization has been successful
-	SDL_LockMutex(mutex);
-	initstatus = 1;
-	SDL_CondBroadcast(initcond);
-	SDL_UnlockMutex(mutex);
-
-	
-	
 	running = 1;
 	while (running) {
+		rcgl_context *ctx;
+
 		if (SDL_WaitEvent(&event)) {
 			// Handle events
 			do {
-				if (event.type == EVENT_REDRAW) {
-					dstatus = 1;
-					if (0 == SDL_LockTexture(tx, NULL, &rbuf, &pitch)) 
-						blit(buf, (uint32_t *)rbuf);	  // Palettize and copy to texture
-					else // Otherwise Failed to open texture, couldn't render.
-						dstatus = 0;
-						
-					SDL_UnlockTexture(tx);
-					SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-					SDL_RenderClear(rend);
-					SDL_RenderCopy(rend, tx, NULL, NULL); // Render texture to entire window
-					SDL_RenderPresent(rend);              // Do update
-
-					// Let update method return now that we're done
-					SDL_LockMutex(mutex);
-					SDL_CondBroadcast(waitdrawcond);
-					drawstatus = dstatus;
-					SDL_UnlockMutex(mutex);
-				}
-				else if (event.type == EVENT_TERM) {
-					SDL_AtomicSet(&status, 0);
+				if (event.type == EVENT_REDRAW)
+					redraw(event.user.data1, event.user.code);
+				else if (event.type == EVENT_SHM)
+					shmpoll(event.user.data1);
+				else if (event.type == EVENT_CREATE)
+					windowinit(event.user.data1);
+				else if (event.type == EVENT_DESTROY)
+					windowfree(event.user.data1);
+				else if (event.type == EVENT_TERM)
 					running = 0;
-				}
 				else switch (event.type) {
 				case SDL_QUIT:
-					SDL_AtomicSet(&status, 0);
-					running = 0;
+					for (ctx = windows; ctx; ctx = ctx->nextwin)
+						windowquit(ctx);
+					break;
+				case SDL_KEYDOWN:
+				case SDL_KEYUP:
+					if ((ctx = winctx(event.key.windowID)))
+						input(ctx, &event);
+					break;
+				case SDL_MOUSEMOTION:
+					if ((ctx = winctx(event.motion.windowID)))
+						input(ctx, &event);
+					break;
+				case SDL_MOUSEBUTTONDOWN:
+				case SDL_MOUSEBUTTONUP:
+					if ((ctx = winctx(event.button.windowID)))
+						input(ctx, &event);
+					break;
+				case SDL_MOUSEWHEEL:
+					if ((ctx = winctx(event.wheel.windowID)))
+						input(ctx, &event);
 					break;
 				case SDL_WINDOWEVENT:
+					if ((ctx = winctx(event.window.windowID)) == NULL)
+						break;
+					// Closing one of several windows only quits its context
+					if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+						windowquit(ctx);
+						break;
+					}
 					// Assume something happened to the window, so just redraw
-					SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-					SDL_RenderClear(rend);
-					SDL_RenderCopy(rend, tx, NULL, NULL); // Render texture to entire window
-					SDL_RenderPresent(rend);              // Do update
+					refresh(ctx);
 					break;
 				
 				}
 			} while (SDL_PollEvent(&event));
 		}
 	}
+
+	SDL_Quit();
+	return 0;
+}
+
+/*
+ * windowinit - Create a context's window, on the video thread
+ * Signals the context waiting in ctxinit with the result
+ */
+static void windowinit(rcgl_context *ctx)
+{
+	int rval = 1;
+	struct CARGS *cargs = &ctx->cargs;
+
+	ctx->wind = SDL_CreateWindow(cargs->title,
+	           SDL_WINDOWPOS_UNDEFINED,
+	           SDL_WINDOWPOS_UNDEFINED,
+	           cargs->ww,
+	           cargs->wh,
+	           ((cargs->wflags&RCGL_RESIZE)?SDL_WINDOW_RESIZABLE:0)
+	           | ((cargs->wflags&RCGL_FULLSCREEN)?SDL_WINDOW_FULLSCREEN:0)
+	           | ((cargs->wflags&RCGL_MAXIMIZED)?SDL_WINDOW_MAXIMIZED:0)
+	           | ((cargs->wflags&RCGL_FULLSCREEN_NATIVE)
+	              ?SDL_WINDOW_FULLSCREEN_DESKTOP:0)
+	           | SDL_WINDOW_ALLOW_HIGHDPI);
+	if (ctx->wind == NULL) {
+		fprintf(stderr, "RCGL: Failed to create Window: %s\n",
+		        SDL_GetError());
+		rval = -4;
+		goto failwind;
+	}
 	
-failalloc:
-	SDL_DestroyTexture(tx);
+	// Without acceleration the renderer would only convert our ARGB texture
+	// again, so let SDL's 8-bit blitter draw straight to the window instead
+	ctx->surfmode = (cargs->wflags & RCGL_SURFACE) != 0;
+	if (!ctx->surfmode) {
+		SDL_RendererInfo info;
+
+		ctx->rend = SDL_CreateRenderer(ctx->wind, -1,
+		           (ctx->vsyncmode == RCGL_VSYNC_ON
+		            || ctx->vsyncmode == RCGL_VSYNC_ADAPTIVE)
+		           ? SDL_RENDERER_PRESENTVSYNC : 0);
+		if (ctx->rend == NULL) {
+			fprintf(stderr, "RCGL: Failed to create Renderer: %s\n",
+			        SDL_GetError());
+			rval = -4;
+			goto failrend;
+		}
+		if (SDL_GetRendererInfo(ctx->rend, &info) == 0
+		    && (info.flags & SDL_RENDERER_SOFTWARE)) {
+			SDL_DestroyRenderer(ctx->rend);
+			ctx->rend = NULL;
+			ctx->surfmode = 1;
+		}
+	}
+	if (ctx->surfmode && surfaceinit(ctx) < 0) {
+		rval = -4;
+		goto failtx;
+	}
+	// Makes the texture too when there's a renderer
+	if (layout(ctx) < 0) {
+		rval = -4;
+		goto failtx;
+	}
+	if (ctx->surfmode) {
+		SDL_UpdateWindowSurface(ctx->wind);
+		goto ready;
+	}
+
+	SDL_SetRenderDrawColor(ctx->rend, 0, 0, 0, 0);
+	SDL_RenderClear(ctx->rend);
+	applyvsync(ctx, ctx->vsyncmode);
+
+	// Clear initial window
+	SDL_SetRenderDrawColor(ctx->rend, 0, 0, 0, 255);
+	SDL_RenderClear(ctx->rend);
+	SDL_RenderPresent(ctx->rend);         // Do update
+
+ready:
+	// Events find their context through the window
+	SDL_SetWindowData(ctx->wind, "rcgl", ctx);
+	ctx->nextwin = windows;
+	windows = ctx;
+	SDL_AtomicSet(&ctx->status, 1);
+	goto signal;
+
+	// Failure path
 failtx:
-	SDL_DestroyRenderer(rend);
+	SDL_DestroyTexture(ctx->tx);
+	ctx->tx = NULL;
+	surfacefree(ctx);
+	SDL_DestroyRenderer(ctx->rend);
+	ctx->rend = NULL;
 failrend:
-	SDL_DestroyWindow(wind);
+	SDL_DestroyWindow(ctx->wind);
+	ctx->wind = NULL;
 failwind:
-	SDL_Quit();
+signal:
+	// Signal to the waiting thread how it went
+	SDL_LockMutex(ctx->mutex);
+	ctx->initstatus = rval;
+	SDL_CondBroadcast(ctx->initcond);
+	SDL_UnlockMutex(ctx->mutex);
+}
+
+/*
+ * windowfree - Destroy a context's window, on the video thread
+ */
+static void windowfree(rcgl_context *ctx)
+{
+	rcgl_context **w;
 
-	// Signal to parent thread that we failed
-	if (rval < 0) {
-		SDL_LockMutex(mutex);
-		initstatus = rval;
-		SDL_CondBroadcast(initcond);
-		SDL_UnlockMutex(mutex);
+	for (w = &windows; *w; w = &(*w)->nextwin) {
+		if (*w == ctx) {
+			*w = ctx->nextwin;
+			break;
+		}
 	}
-	
-	return rval;
+
+	SDL_DestroyTexture(ctx->tx);
+	surfacefree(ctx);
+	SDL_DestroyRenderer(ctx->rend);
+	SDL_DestroyWindow(ctx->wind);
+	ctx->tx = NULL;
+	ctx->rend = NULL;
+	ctx->wind = NULL;
+
+	// Release anyone still waiting on a frame, and rcgl_ctx_quit
+	SDL_AtomicSet(&ctx->status, 0);
+	SDL_LockMutex(ctx->mutex);
+	ctx->initstatus = 0;
+	SDL_CondBroadcast(ctx->waitdrawcond);
+	SDL_CondBroadcast(ctx->initcond);
+	SDL_UnlockMutex(ctx->mutex);
+}
+
+/*
+ * windowquit - Mark a context as quit, its window stays till rcgl_ctx_quit
+ */
+static void windowquit(rcgl_context *ctx)
+{
+	SDL_AtomicSet(&ctx->status, 0);
+	SDL_LockMutex(ctx->mutex);
+	SDL_CondBroadcast(ctx->waitdrawcond);
+	SDL_UnlockMutex(ctx->mutex);
+}
+
+/*
+ * winctx - Find the context a window belongs to, or NULL
+ */
+static rcgl_context *winctx(uint32_t id)
+{
+	SDL_Window *w = SDL_GetWindowFromID(id);
+
+	return w ? SDL_GetWindowData(w, "rcgl") : NULL;
+}
+
+/*
+ * redraw - Draw a context's latest frame to its window, on the video thread
+ * async is set for frames from rcgl_submit, otherwise the buffer itself is
+ * drawn for rcgl_update.
+ */
+static void redraw(rcgl_context *ctx, int async)
+{
+	const uint8_t *src;
+	const uint32_t *pal = ctx->palette;
+	SDL_Rect rects[MAXDIRTY];
+	int nrects;
+	int dstatus;
+	int relayout;
+	uint32_t id;
+	uint64_t pushed, taken;
+
+	// Take the latest submitted frame, or the buffer itself
+	// for a plain rcgl_update
+	SDL_LockMutex(ctx->mutex);
+	if (async && ctx->fpending < 0) {
+		SDL_UnlockMutex(ctx->mutex);
+		return;
+	}
+	if (async) {
+		ctx->fbusy = ctx->fpending;
+		id = ctx->fpendingid;
+		ctx->fpending = -1;
+		src = ctx->fring[ctx->fbusy];
+		pal = ctx->fpal[ctx->fbusy];
+		ctx->drawlayers = &ctx->flayers[ctx->fbusy];
+	}
+	else {
+		src = ctx->buf;
+		id = ctx->fupdateid;
+		ctx->drawlayers = &ctx->ulayers;
+	}
+	memcpy(rects, ctx->udirty, ctx->nudirty * sizeof(SDL_Rect));
+	nrects = ctx->nudirty;
+	ctx->nudirty = 0;
+	pushed = ctx->fpushtime;
+	relayout = ctx->relayout;
+	if (relayout) {
+		ctx->scalemode = ctx->wantscale;
+		ctx->aspw = ctx->wantaspw;
+		ctx->asph = ctx->wantasph;
+		ctx->relayout = 0;
+	}
+	SDL_UnlockMutex(ctx->mutex);
+	taken = SDL_GetPerformanceCounter();
+
+	// Scaling changed, so the whole frame goes out again. Without tracked
+	// damage, dropping the last frame's copy does the same.
+	if (relayout && layout(ctx) >= 0) {
+		rects[0].x = rects[0].y = 0;
+		rects[0].w = ctx->bw;
+		rects[0].h = ctx->bh;
+		nrects = 1;
+		free(ctx->shadow);
+		ctx->shadow = NULL;
+	}
+
+	// Palettize and copy to texture
+	dstatus = render(ctx, src, pal, rects, &nrects);
+	if (SDL_AtomicGet(&ctx->wantvsync) != ctx->vsyncmode)
+		applyvsync(ctx, SDL_AtomicGet(&ctx->wantvsync));
+	if (ctx->vsyncmode == RCGL_VSYNC_FIXED) {
+		uint64_t t = SDL_GetPerformanceCounter();
+		pace(&ctx->pacedeadline, SDL_AtomicGet(&ctx->pacehz));
+		timed(ctx, RCGL_STAGE_PRESENT, t);
+	}
+	present(ctx, rects, nrects);
+	ctx->ftimes[RCGL_STAGE_HANDOFF].start = pushed;
+	ctx->ftimes[RCGL_STAGE_HANDOFF].dur = taken - pushed;
+
+	// Let update method return now that we're done. Window events redraw
+	// from src till whoever owns it says it's gone.
+	SDL_LockMutex(ctx->mutex);
+	commitstats(ctx);
+	ctx->lastsrc = src;
+	ctx->fbusy = -1;
+	if ((int32_t)(id - SDL_AtomicGet(&ctx->fpresented)) > 0)
+		SDL_AtomicSet(&ctx->fpresented, id);
+	ctx->drawstatus = dstatus;
+	SDL_CondBroadcast(ctx->waitdrawcond);
+	SDL_UnlockMutex(ctx->mutex);
+}
+
+/*
+ * shmpoll - Show the latest frame posted to a context's shared framebuffer
+ * Drawn the same as for rcgl_update, from whatever the buffer is set to.
+ */
+static void shmpoll(rcgl_context *ctx)
+{
+	rcgl_shm *s;
+	int32_t seq;
+
+	// Frames posted from here on need another event
+	SDL_AtomicSet(&ctx->shmqueued, 0);
+
+	// seq is only bumped once a frame is complete, so what it says is there
+	// is what gets shown. dirty is cleared for writers watching it.
+	SDL_LockMutex(ctx->mutex);
+	s = ctx->shmwatch;
+	if (s == NULL || (seq = SDL_AtomicGet(SHMATOM(s->seq)))
+	                 == SDL_AtomicGet(SHMATOM(s->shown))) {
+		SDL_UnlockMutex(ctx->mutex);
+		return;
+	}
+	ctx->shmbusy = 1;
+	damagelist(ctx, ctx->udirty, &ctx->nudirty, 0, 0, ctx->bw, ctx->bh);
+	ctx->fpushtime = SDL_GetPerformanceCounter();
+	SDL_UnlockMutex(ctx->mutex);
+
+	SDL_AtomicSet(SHMATOM(s->dirty), 0);
+	SDL_MemoryBarrierAcquire();
+	redraw(ctx, 0);
+	SDL_AtomicSet(SHMATOM(s->shown), seq);
+	shmwake(&s->shown);
+
+	SDL_LockMutex(ctx->mutex);
+	ctx->shmbusy = 0;
+	SDL_CondBroadcast(ctx->waitdrawcond);
+	SDL_UnlockMutex(ctx->mutex);
+}
+
+#ifdef RCGL_HAVE_SHM
+/*
+ * shmthread - Wake the video thread for frames posted to a context's region
+ * At most one EVENT_SHM is queued at a time, however fast frames come.
+ */
+static int shmthread(void *data)
+{
+	rcgl_context *ctx = data;
+	rcgl_shm *s = ctx->shm;
+	int32_t seq = SDL_AtomicGet(SHMATOM(s->shown));  // Frames may come first
+
+	while (!SDL_AtomicGet(&ctx->shmstop)) {
+		SDL_Event event;
+		int32_t now = SDL_AtomicGet(SHMATOM(s->seq));
+
+		if (now == seq) {
+			shmsleep(&s->seq, seq);
+			continue;
+		}
+		seq = now;
+		if (!SDL_AtomicCAS(&ctx->shmqueued, 0, 1))
+			continue;
+		SDL_zero(event);
+		event.type = EVENT_SHM;
+		event.user.data1 = ctx;
+		SDL_PushEvent(&event);
+	}
+	return 0;
+}
+#endif
+
+/*
+ * shmsleep - Sleep while a shared framebuffer counter v is still old
+ * Woken by shmwake, or after SHMSLEEP ms in case the other side went away.
+ * Without futexes it's a 1 ms poll.
+ */
+static void shmsleep(int32_t *v, int32_t old)
+{
+#ifdef RCGL_HAVE_FUTEX
+	struct timespec ts = { 0, SHMSLEEP * 1000000L };
+
+	// Not FUTEX_PRIVATE, the other side is in another process
+	syscall(SYS_futex, v, FUTEX_WAIT, old, &ts, NULL, 0);
+#else
+	(void)v;
+	(void)old;
+	SDL_Delay(1);
+#endif
+}
+
+/*
+ * shmwake - Wake everyone sleeping on shared framebuffer counter v
+ */
+static void shmwake(int32_t *v)
+{
+#ifdef RCGL_HAVE_FUTEX
+	syscall(SYS_futex, v, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)v;
+#endif
+}
+
+/*
+ * spritesize - Bytes of run data in a compiled sprite
+ */
+static size_t spritesize(const rcgl_sprite *s)
+{
+	const uint8_t *p = s->data + s->rows[s->h - 1];
+	int runs = p[0] | (p[1] << 8);
+
+	// Rows are laid out in order, so the last one ends the data
+	p += 2;
+	while (runs--)
+		p += 4 + (p[2] | (p[3] << 8));
+	return p - s->data;
+}
+
+/*
+ * spritecheck - Walk a sprite's runs, as spritesize does, making sure none
+ * read past datasize bytes of run data or draw past the sprite's width
+ * Returns -1 if one does.
+ */
+static int spritecheck(const rcgl_sprite *s, size_t datasize)
+{
+	for (int y = 0; y < s->h; y++) {
+		size_t o = s->rows[y];
+		int runs, x = 0;
+
+		if ((uint64_t)o + 2 > datasize)
+			return -1;
+		runs = s->data[o] | (s->data[o + 1] << 8);
+		o += 2;
+		while (runs--) {
+			const uint8_t *p = s->data + o;
+			int n;
+
+			if (o + 4 > datasize)
+				return -1;
+			x += p[0] | (p[1] << 8);
+			n = p[2] | (p[3] << 8);
+			o += 4 + n;
+			x += n;
+			if (o > datasize || x > s->w)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * pakcmp - Order asset pack directory entries by name, for qsort
+ */
+static int pakcmp(const void *a, const void *b)
+{
+	return strcmp((*(const struct PAKENTRY *const *)a)->name,
+	              (*(const struct PAKENTRY *const *)b)->name);
+}
+
+/*
+ * pakpad - Write zeros from pos up to offset to in an asset pack
+ */
+static int pakpad(FILE *f, uint32_t *pos, uint32_t to)
+{
+	static const uint8_t zero[PAKALIGN];
+
+	if (to > *pos && fwrite(zero, to - *pos, 1, f) != 1)
+		return -1;
+	*pos = to;
+	return 0;
 }
 
 
@@ -628,3 +6615,203 @@ const uint32_t RCGL_PALETTE_GREY[256] = {
 0x00fcfcfc, 0x00fdfdfd, 0x00fefefe, 0x00ffffff };
 
 
+/* Fonts */
+
+// IBM CGA 8x8 and VGA 8x16 character ROMs, printable ASCII only
+static const uint8_t font8x8[95 * 8] = {
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // ' '
+0x18, 0x3c, 0x3c, 0x18, 0x18, 0x00, 0x18, 0x00, // '!'
+0x6c, 0x6c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '"'
+0x6c, 0x6c, 0xfe, 0x6c, 0xfe, 0x6c, 0x6c, 0x00, // '#'
+0x30, 0x7c, 0xc0, 0x78, 0x0c, 0xf8, 0x30, 0x00, // '$'
+0x00, 0xc6, 0xcc, 0x18, 0x30, 0x66, 0xc6, 0x00, // '%'
+0x38, 0x6c, 0x38, 0x76, 0xdc, 0xcc, 0x76, 0x00, // '&'
+0x60, 0x60, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, // '\''
+0x18, 0x30, 0x60, 0x60, 0x60, 0x30, 0x18, 0x00, // '('
+0x60, 0x30, 0x18, 0x18, 0x18, 0x30, 0x60, 0x00, // ')'
+0x00, 0x66, 0x3c, 0xff, 0x3c, 0x66, 0x00, 0x00, // '*'
+0x00, 0x30, 0x30, 0xfc, 0x30, 0x30, 0x00, 0x00, // '+'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x60, // ','
+0x00, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x00, 0x00, // '-'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00, // '.'
+0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x80, 0x00, // '/'
+0x7c, 0xc6, 0xce, 0xde, 0xf6, 0xe6, 0x7c, 0x00, // '0'
+0x30, 0x70, 0x30, 0x30, 0x30, 0x30, 0xfc, 0x00, // '1'
+0x78, 0xcc, 0x0c, 0x38, 0x60, 0xcc, 0xfc, 0x00, // '2'
+0x78, 0xcc, 0x0c, 0x38, 0x0c, 0xcc, 0x78, 0x00, // '3'
+0x1c, 0x3c, 0x6c, 0xcc, 0xfe, 0x0c, 0x1e, 0x00, // '4'
+0xfc, 0xc0, 0xf8, 0x0c, 0x0c, 0xcc, 0x78, 0x00, // '5'
+0x38, 0x60, 0xc0, 0xf8, 0xcc, 0xcc, 0x78, 0x00, // '6'
+0xfc, 0xcc, 0x0c, 0x18, 0x30, 0x30, 0x30, 0x00, // '7'
+0x78, 0xcc, 0xcc, 0x78, 0xcc, 0xcc, 0x78, 0x00, // '8'
+0x78, 0xcc, 0xcc, 0x7c, 0x0c, 0x18, 0x70, 0x00, // '9'
+0x00, 0x30, 0x30, 0x00, 0x00, 0x30, 0x30, 0x00, // ':'
+0x00, 0x30, 0x30, 0x00, 0x00, 0x30, 0x30, 0x60, // ';'
+0x18, 0x30, 0x60, 0xc0, 0x60, 0x30, 0x18, 0x00, // '<'
+0x00, 0x00, 0xfc, 0x00, 0x00, 0xfc, 0x00, 0x00, // '='
+0x60, 0x30, 0x18, 0x0c, 0x18, 0x30, 0x60, 0x00, // '>'
+0x78, 0xcc, 0x0c, 0x18, 0x30, 0x00, 0x30, 0x00, // '?'
+0x7c, 0xc6, 0xde, 0xde, 0xde, 0xc0, 0x78, 0x00, // '@'
+0x30, 0x78, 0xcc, 0xcc, 0xfc, 0xcc, 0xcc, 0x00, // 'A'
+0xfc, 0x66, 0x66, 0x7c, 0x66, 0x66, 0xfc, 0x00, // 'B'
+0x3c, 0x66, 0xc0, 0xc0, 0xc0, 0x66, 0x3c, 0x00, // 'C'
+0xf8, 0x6c, 0x66, 0x66, 0x66, 0x6c, 0xf8, 0x00, // 'D'
+0xfe, 0x62, 0x68, 0x78, 0x68, 0x62, 0xfe, 0x00, // 'E'
+0xfe, 0x62, 0x68, 0x78, 0x68, 0x60, 0xf0, 0x00, // 'F'
+0x3c, 0x66, 0xc0, 0xc0, 0xce, 0x66, 0x3e, 0x00, // 'G'
+0xcc, 0xcc, 0xcc, 0xfc, 0xcc, 0xcc, 0xcc, 0x00, // 'H'
+0x78, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00, // 'I'
+0x1e, 0x0c, 0x0c, 0x0c, 0xcc, 0xcc, 0x78, 0x00, // 'J'
+0xe6, 0x66, 0x6c, 0x78, 0x6c, 0x66, 0xe6, 0x00, // 'K'
+0xf0, 0x60, 0x60, 0x60, 0x62, 0x66, 0xfe, 0x00, // 'L'
+0xc6, 0xee, 0xfe, 0xfe, 0xd6, 0xc6, 0xc6, 0x00, // 'M'
+0xc6, 0xe6, 0xf6, 0xde, 0xce, 0xc6, 0xc6, 0x00, // 'N'
+0x38, 0x6c, 0xc6, 0xc6, 0xc6, 0x6c, 0x38, 0x00, // 'O'
+0xfc, 0x66, 0x66, 0x7c, 0x60, 0x60, 0xf0, 0x00, // 'P'
+0x78, 0xcc, 0xcc, 0xcc, 0xdc, 0x78, 0x1c, 0x00, // 'Q'
+0xfc, 0x66, 0x66, 0x7c, 0x6c, 0x66, 0xe6, 0x00, // 'R'
+0x78, 0xcc, 0xe0, 0x70, 0x1c, 0xcc, 0x78, 0x00, // 'S'
+0xfc, 0xb4, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00, // 'T'
+0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xfc, 0x00, // 'U'
+0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0x78, 0x30, 0x00, // 'V'
+0xc6, 0xc6, 0xc6, 0xd6, 0xfe, 0xee, 0xc6, 0x00, // 'W'
+0xc6, 0xc6, 0x6c, 0x38, 0x38, 0x6c, 0xc6, 0x00, // 'X'
+0xcc, 0xcc, 0xcc, 0x78, 0x30, 0x30, 0x78, 0x00, // 'Y'
+0xfe, 0xc6, 0x8c, 0x18, 0x32, 0x66, 0xfe, 0x00, // 'Z'
+0x78, 0x60, 0x60, 0x60, 0x60, 0x60, 0x78, 0x00, // '['
+0xc0, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x02, 0x00, // '\\'
+0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x78, 0x00, // ']'
+0x10, 0x38, 0x6c, 0xc6, 0x00, 0x00, 0x00, 0x00, // '^'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, // '_'
+0x30, 0x30, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, // '`'
+0x00, 0x00, 0x78, 0x0c, 0x7c, 0xcc, 0x76, 0x00, // 'a'
+0xe0, 0x60, 0x60, 0x7c, 0x66, 0x66, 0xdc, 0x00, // 'b'
+0x00, 0x00, 0x78, 0xcc, 0xc0, 0xcc, 0x78, 0x00, // 'c'
+0x1c, 0x0c, 0x0c, 0x7c, 0xcc, 0xcc, 0x76, 0x00, // 'd'
+0x00, 0x00, 0x78, 0xcc, 0xfc, 0xc0, 0x78, 0x00, // 'e'
+0x38, 0x6c, 0x60, 0xf0, 0x60, 0x60, 0xf0, 0x00, // 'f'
+0x00, 0x00, 0x76, 0xcc, 0xcc, 0x7c, 0x0c, 0xf8, // 'g'
+0xe0, 0x60, 0x6c, 0x76, 0x66, 0x66, 0xe6, 0x00, // 'h'
+0x30, 0x00, 0x70, 0x30, 0x30, 0x30, 0x78, 0x00, // 'i'
+0x0c, 0x00, 0x0c, 0x0c, 0x0c, 0xcc, 0xcc, 0x78, // 'j'
+0xe0, 0x60, 0x66, 0x6c, 0x78, 0x6c, 0xe6, 0x00, // 'k'
+0x70, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00, // 'l'
+0x00, 0x00, 0xcc, 0xfe, 0xfe, 0xd6, 0xc6, 0x00, // 'm'
+0x00, 0x00, 0xf8, 0xcc, 0xcc, 0xcc, 0xcc, 0x00, // 'n'
+0x00, 0x00, 0x78, 0xcc, 0xcc, 0xcc, 0x78, 0x00, // 'o'
+0x00, 0x00, 0xdc, 0x66, 0x66, 0x7c, 0x60, 0xf0, // 'p'
+0x00, 0x00, 0x76, 0xcc, 0xcc, 0x7c, 0x0c, 0x1e, // 'q'
+0x00, 0x00, 0xdc, 0x76, 0x66, 0x60, 0xf0, 0x00, // 'r'
+0x00, 0x00, 0x7c, 0xc0, 0x78, 0x0c, 0xf8, 0x00, // 's'
+0x10, 0x30, 0x7c, 0x30, 0x30, 0x34, 0x18, 0x00, // 't'
+0x00, 0x00, 0xcc, 0xcc, 0xcc, 0xcc, 0x76, 0x00, // 'u'
+0x00, 0x00, 0xcc, 0xcc, 0xcc, 0x78, 0x30, 0x00, // 'v'
+0x00, 0x00, 0xc6, 0xd6, 0xfe, 0xfe, 0x6c, 0x00, // 'w'
+0x00, 0x00, 0xc6, 0x6c, 0x38, 0x6c, 0xc6, 0x00, // 'x'
+0x00, 0x00, 0xcc, 0xcc, 0xcc, 0x7c, 0x0c, 0xf8, // 'y'
+0x00, 0x00, 0xfc, 0x98, 0x30, 0x64, 0xfc, 0x00, // 'z'
+0x1c, 0x30, 0x30, 0xe0, 0x30, 0x30, 0x1c, 0x00, // '{'
+0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00, // '|'
+0xe0, 0x30, 0x30, 0x1c, 0x30, 0x30, 0xe0, 0x00, // '}'
+0x76, 0xdc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '~'
+};
+
+static const uint8_t font9x16[95 * 16] = {
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // ' '
+0x00, 0x00, 0x18, 0x3c, 0x3c, 0x3c, 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, // '!'
+0x00, 0x66, 0x66, 0x66, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '"'
+0x00, 0x00, 0x00, 0x6c, 0x6c, 0xfe, 0x6c, 0x6c, 0x6c, 0xfe, 0x6c, 0x6c, 0x00, 0x00, 0x00, 0x00, // '#'
+0x18, 0x18, 0x7c, 0xc6, 0xc2, 0xc0, 0x7c, 0x06, 0x06, 0x86, 0xc6, 0x7c, 0x18, 0x18, 0x00, 0x00, // '$'
+0x00, 0x00, 0x00, 0x00, 0xc2, 0xc6, 0x0c, 0x18, 0x30, 0x60, 0xc6, 0x86, 0x00, 0x00, 0x00, 0x00, // '%'
+0x00, 0x00, 0x38, 0x6c, 0x6c, 0x38, 0x76, 0xdc, 0xcc, 0xcc, 0xcc, 0x76, 0x00, 0x00, 0x00, 0x00, // '&'
+0x00, 0x30, 0x30, 0x30, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '\''
+0x00, 0x00, 0x0c, 0x18, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x18, 0x0c, 0x00, 0x00, 0x00, 0x00, // '('
+0x00, 0x00, 0x30, 0x18, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x18, 0x30, 0x00, 0x00, 0x00, 0x00, // ')'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x3c, 0xff, 0x3c, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '*'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x7e, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '+'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x30, 0x00, 0x00, 0x00, // ','
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '-'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, // '.'
+0x00, 0x00, 0x00, 0x00, 0x02, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x80, 0x00, 0x00, 0x00, 0x00, // '/'
+0x00, 0x00, 0x38, 0x6c, 0xc6, 0xc6, 0xd6, 0xd6, 0xc6, 0xc6, 0x6c, 0x38, 0x00, 0x00, 0x00, 0x00, // '0'
+0x00, 0x00, 0x18, 0x38, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00, 0x00, 0x00, 0x00, // '1'
+0x00, 0x00, 0x7c, 0xc6, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0xc6, 0xfe, 0x00, 0x00, 0x00, 0x00, // '2'
+0x00, 0x00, 0x7c, 0xc6, 0x06, 0x06, 0x3c, 0x06, 0x06, 0x06, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // '3'
+0x00, 0x00, 0x0c, 0x1c, 0x3c, 0x6c, 0xcc, 0xfe, 0x0c, 0x0c, 0x0c, 0x1e, 0x00, 0x00, 0x00, 0x00, // '4'
+0x00, 0x00, 0xfe, 0xc0, 0xc0, 0xc0, 0xfc, 0x06, 0x06, 0x06, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // '5'
+0x00, 0x00, 0x38, 0x60, 0xc0, 0xc0, 0xfc, 0xc6, 0xc6, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // '6'
+0x00, 0x00, 0xfe, 0xc6, 0x06, 0x06, 0x0c, 0x18, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00, // '7'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xc6, 0x7c, 0xc6, 0xc6, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // '8'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xc6, 0x7e, 0x06, 0x06, 0x06, 0x0c, 0x78, 0x00, 0x00, 0x00, 0x00, // '9'
+0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, // ':'
+0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x30, 0x00, 0x00, 0x00, 0x00, // ';'
+0x00, 0x00, 0x00, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x00, 0x00, 0x00, 0x00, // '<'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '='
+0x00, 0x00, 0x00, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x00, 0x00, 0x00, 0x00, // '>'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0x0c, 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, // '?'
+0x00, 0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xde, 0xde, 0xde, 0xdc, 0xc0, 0x7c, 0x00, 0x00, 0x00, 0x00, // '@'
+0x00, 0x00, 0x10, 0x38, 0x6c, 0xc6, 0xc6, 0xfe, 0xc6, 0xc6, 0xc6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'A'
+0x00, 0x00, 0xfc, 0x66, 0x66, 0x66, 0x7c, 0x66, 0x66, 0x66, 0x66, 0xfc, 0x00, 0x00, 0x00, 0x00, // 'B'
+0x00, 0x00, 0x3c, 0x66, 0xc2, 0xc0, 0xc0, 0xc0, 0xc0, 0xc2, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'C'
+0x00, 0x00, 0xf8, 0x6c, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x6c, 0xf8, 0x00, 0x00, 0x00, 0x00, // 'D'
+0x00, 0x00, 0xfe, 0x66, 0x62, 0x68, 0x78, 0x68, 0x60, 0x62, 0x66, 0xfe, 0x00, 0x00, 0x00, 0x00, // 'E'
+0x00, 0x00, 0xfe, 0x66, 0x62, 0x68, 0x78, 0x68, 0x60, 0x60, 0x60, 0xf0, 0x00, 0x00, 0x00, 0x00, // 'F'
+0x00, 0x00, 0x3c, 0x66, 0xc2, 0xc0, 0xc0, 0xde, 0xc6, 0xc6, 0x66, 0x3a, 0x00, 0x00, 0x00, 0x00, // 'G'
+0x00, 0x00, 0xc6, 0xc6, 0xc6, 0xc6, 0xfe, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'H'
+0x00, 0x00, 0x3c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'I'
+0x00, 0x00, 0x1e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xcc, 0xcc, 0xcc, 0x78, 0x00, 0x00, 0x00, 0x00, // 'J'
+0x00, 0x00, 0xe6, 0x66, 0x66, 0x6c, 0x78, 0x78, 0x6c, 0x66, 0x66, 0xe6, 0x00, 0x00, 0x00, 0x00, // 'K'
+0x00, 0x00, 0xf0, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x62, 0x66, 0xfe, 0x00, 0x00, 0x00, 0x00, // 'L'
+0x00, 0x00, 0xc6, 0xee, 0xfe, 0xfe, 0xd6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'M'
+0x00, 0x00, 0xc6, 0xe6, 0xf6, 0xfe, 0xde, 0xce, 0xc6, 0xc6, 0xc6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'N'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'O'
+0x00, 0x00, 0xfc, 0x66, 0x66, 0x66, 0x7c, 0x60, 0x60, 0x60, 0x60, 0xf0, 0x00, 0x00, 0x00, 0x00, // 'P'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xd6, 0xde, 0x7c, 0x0c, 0x0e, 0x00, 0x00, // 'Q'
+0x00, 0x00, 0xfc, 0x66, 0x66, 0x66, 0x7c, 0x6c, 0x66, 0x66, 0x66, 0xe6, 0x00, 0x00, 0x00, 0x00, // 'R'
+0x00, 0x00, 0x7c, 0xc6, 0xc6, 0x60, 0x38, 0x0c, 0x06, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'S'
+0x00, 0x00, 0x7e, 0x7e, 0x5a, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'T'
+0x00, 0x00, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'U'
+0x00, 0x00, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x6c, 0x38, 0x10, 0x00, 0x00, 0x00, 0x00, // 'V'
+0x00, 0x00, 0xc6, 0xc6, 0xc6, 0xc6, 0xd6, 0xd6, 0xd6, 0xfe, 0xee, 0x6c, 0x00, 0x00, 0x00, 0x00, // 'W'
+0x00, 0x00, 0xc6, 0xc6, 0x6c, 0x7c, 0x38, 0x38, 0x7c, 0x6c, 0xc6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'X'
+0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x3c, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'Y'
+0x00, 0x00, 0xfe, 0xc6, 0x86, 0x0c, 0x18, 0x30, 0x60, 0xc2, 0xc6, 0xfe, 0x00, 0x00, 0x00, 0x00, // 'Z'
+0x00, 0x00, 0x3c, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x3c, 0x00, 0x00, 0x00, 0x00, // '['
+0x00, 0x00, 0x00, 0x80, 0xc0, 0xe0, 0x70, 0x38, 0x1c, 0x0e, 0x06, 0x02, 0x00, 0x00, 0x00, 0x00, // '\\'
+0x00, 0x00, 0x3c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x3c, 0x00, 0x00, 0x00, 0x00, // ']'
+0x10, 0x38, 0x6c, 0xc6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '^'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, // '_'
+0x30, 0x30, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '`'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x78, 0x0c, 0x7c, 0xcc, 0xcc, 0xcc, 0x76, 0x00, 0x00, 0x00, 0x00, // 'a'
+0x00, 0x00, 0xe0, 0x60, 0x60, 0x78, 0x6c, 0x66, 0x66, 0x66, 0x66, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'b'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0xc6, 0xc0, 0xc0, 0xc0, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'c'
+0x00, 0x00, 0x1c, 0x0c, 0x0c, 0x3c, 0x6c, 0xcc, 0xcc, 0xcc, 0xcc, 0x76, 0x00, 0x00, 0x00, 0x00, // 'd'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0xc6, 0xfe, 0xc0, 0xc0, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'e'
+0x00, 0x00, 0x1c, 0x36, 0x32, 0x30, 0x78, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00, 0x00, 0x00, 0x00, // 'f'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x76, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0x7c, 0x0c, 0xcc, 0x78, 0x00, // 'g'
+0x00, 0x00, 0xe0, 0x60, 0x60, 0x6c, 0x76, 0x66, 0x66, 0x66, 0x66, 0xe6, 0x00, 0x00, 0x00, 0x00, // 'h'
+0x00, 0x00, 0x18, 0x18, 0x00, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'i'
+0x00, 0x00, 0x06, 0x06, 0x00, 0x0e, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x66, 0x66, 0x3c, 0x00, // 'j'
+0x00, 0x00, 0xe0, 0x60, 0x60, 0x66, 0x6c, 0x78, 0x78, 0x6c, 0x66, 0xe6, 0x00, 0x00, 0x00, 0x00, // 'k'
+0x00, 0x00, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00, 0x00, 0x00, 0x00, // 'l'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xec, 0xfe, 0xd6, 0xd6, 0xd6, 0xd6, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'm'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xdc, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00, // 'n'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 'o'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xdc, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7c, 0x60, 0x60, 0xf0, 0x00, // 'p'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x76, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0x7c, 0x0c, 0x0c, 0x1e, 0x00, // 'q'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xdc, 0x76, 0x66, 0x60, 0x60, 0x60, 0xf0, 0x00, 0x00, 0x00, 0x00, // 'r'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0xc6, 0x60, 0x38, 0x0c, 0xc6, 0x7c, 0x00, 0x00, 0x00, 0x00, // 's'
+0x00, 0x00, 0x10, 0x30, 0x30, 0xfc, 0x30, 0x30, 0x30, 0x30, 0x36, 0x1c, 0x00, 0x00, 0x00, 0x00, // 't'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0x76, 0x00, 0x00, 0x00, 0x00, // 'u'
+0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3c, 0x18, 0x00, 0x00, 0x00, 0x00, // 'v'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xc6, 0xc6, 0xd6, 0xd6, 0xd6, 0xfe, 0x6c, 0x00, 0x00, 0x00, 0x00, // 'w'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xc6, 0x6c, 0x38, 0x38, 0x38, 0x6c, 0xc6, 0x00, 0x00, 0x00, 0x00, // 'x'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0xc6, 0x7e, 0x06, 0x0c, 0xf8, 0x00, // 'y'
+0x00, 0x00, 0x00, 0x00, 0x00, 0xfe, 0xcc, 0x18, 0x30, 0x60, 0xc6, 0xfe, 0x00, 0x00, 0x00, 0x00, // 'z'
+0x00, 0x00, 0x0e, 0x18, 0x18, 0x18, 0x70, 0x18, 0x18, 0x18, 0x18, 0x0e, 0x00, 0x00, 0x00, 0x00, // '{'
+0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, // '|'
+0x00, 0x00, 0x70, 0x18, 0x18, 0x18, 0x0e, 0x18, 0x18, 0x18, 0x18, 0x70, 0x00, 0x00, 0x00, 0x00, // '}'
+0x00, 0x00, 0x76, 0xdc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // '~'
+};
+const rcgl_font RCGL_FONT_CGA = { 8, 8, 32, 95, font8x8 };
+const rcgl_font RCGL_FONT_VGA = { 9, 16, 32, 95, font9x16 };
@@ -58,23 +58,333 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define RCGL_MAXIMIZED  4
 #define RCGL_FULLSCREEN_NATIVE 8
 #define RCGL_INTSCALE	16
+#define RCGL_DIRTYRECT  32
+#define RCGL_HEADLESS   64
+#define RCGL_SURFACE    128
+#define RCGL_NOVSYNC    256
+#define RCGL_ADAPTIVEVSYNC 512
+
+// Frame pacing modes
+#define RCGL_VSYNC_ON       0
+#define RCGL_VSYNC_OFF      1
+#define RCGL_VSYNC_ADAPTIVE 2
+#define RCGL_VSYNC_FIXED    3
+
+// Scaler modes
+#define RCGL_SCALE_AUTO     0     // Whichever is cheapest for the renderer
+#define RCGL_SCALE_RENDERER 1     // Renderer or SDL blitter stretches frame
+#define RCGL_SCALE_INTEGER  2     // Expanded by whole pixels when converted
+#define RCGL_SCALE_SHARP    3     // Integer expansion then smoothed to fit
+
+// Blit flags
+#define RCGL_FLIPX 1
+#define RCGL_FLIPY 2
+#define RCGL_WRAP  4              // Tile the source, for rcgl_blit_mode7
+
+// Layers behind the buffer
+#define RCGL_MAXLAYERS 8
+
+// Asset pack entry types
+#define RCGL_PAK_PALETTE 1
+#define RCGL_PAK_BITMAP  2
+
+// Capture export formats
+#define RCGL_EXPORT_RAW 0
+#define RCGL_EXPORT_Y4M 1
+#define RCGL_EXPORT_PNG 2
+
+// Input event types
+#define RCGL_KEYDOWN    1
+#define RCGL_KEYUP      2
+#define RCGL_MOUSEMOVE  3
+#define RCGL_MOUSEDOWN  4
+#define RCGL_MOUSEUP    5
+#define RCGL_MOUSEWHEEL 6
+
+#define RCGL_NUMKEYS    512
+
+// Stages of drawing a frame timed by rcgl_stats
+#define RCGL_STAGE_HANDOFF  0     // Update requested till video thread starts
+#define RCGL_STAGE_DIFF     1     // Finding what changed
+#define RCGL_STAGE_CONVERT  2     // Palette conversion
+#define RCGL_STAGE_LOCK     3     // Locking and unlocking the texture
+#define RCGL_STAGE_COPY     4     // Copying the texture to the window
+#define RCGL_STAGE_PRESENT  5     // Presenting, including waiting for vsync
+#define RCGL_STAGE_WAIT     6     // Waiting in rcgl_update or rcgl_wait
+#define RCGL_STAGE_FRAME    7     // Time between frames being shown
+#define RCGL_NUMSTAGES      8
+
+typedef struct rcgl_context rcgl_context;
+typedef struct rcgl_sprite rcgl_sprite;
+typedef struct rcgl_atlas rcgl_atlas;
+typedef struct rcgl_cmdlist rcgl_cmdlist;
+typedef struct rcgl_pak rcgl_pak;
+
+typedef struct rcgl_font {
+	int w, h;                 // Character cell size
+	int first, count;         // Characters held
+	const uint8_t *bits;      // h rows per character, leftmost pixel in bit 7
+} rcgl_font;
+
+// Source position at x = 0 of one row of rcgl_blit_mode7, and the step per
+// pixel, all 16.16 fixed point
+typedef struct rcgl_scanline {
+	int32_t u, v;
+	int32_t du, dv;
+} rcgl_scanline;
+
+// Fills in s for buffer row y, returning 0 to leave the row alone
+typedef int (*rcgl_scanfn)(void *data, int y, rcgl_scanline *s);
+
+typedef struct rcgl_textitem {
+	int x, y;
+	const char *str;
+	int fg, bg;
+} rcgl_textitem;
+
+typedef struct rcgl_event {
+	int type;
+	int code;                 // SDL scancode, or mouse button (1 is left)
+	int x, y;                 // Mouse position in buffer pixels, or wheel
+	uint32_t time;            // rcgl_ticks() when it happened
+} rcgl_event;
+
+typedef struct rcgl_input {
+	uint8_t keys[RCGL_NUMKEYS]; // Held keys, by SDL scancode
+	int x, y;                 // Mouse position in buffer pixels
+	uint32_t buttons;         // Held mouse buttons, bit 0 is the left
+	int wheelx, wheely;       // Total wheel movement
+} rcgl_input;
+
+typedef struct rcgl_framestats {
+	struct {
+		double min, avg, p99, last;   // Milliseconds
+	} stage[RCGL_NUMSTAGES];
+	double fps;
+	uint32_t frames;          // Frames shown
+	uint32_t dropped;         // Submitted frames replaced before being shown
+	uint32_t capdropped;      // Frames the capture writer fell behind on
+} rcgl_framestats;
+
+// An asset for rcgl_pak_write to pack
+typedef struct rcgl_pakitem {
+	const char *name;         // Up to 31 characters
+	int type;                 // RCGL_PAK_PALETTE or RCGL_PAK_BITMAP
+	const void *data;         // 256 palette entries, or w x h pixels
+	int w, h;
+	int trans;                // Also pack the bitmap compiled as a sprite
+	                          // keyed on trans, or -1 not to
+} rcgl_pakitem;
+
+// Start of a shared framebuffer made by rcgl_shm_create. The buffer follows
+// at bufoff, w bytes a row. The counters are only changed atomically.
+#define RCGL_SHM_MAGIC 0x4D534352 // "RCSM"
+typedef struct rcgl_shm {
+	uint32_t magic;           // RCGL_SHM_MAGIC while the display has it open
+	uint32_t size;            // Bytes in the whole region
+	int32_t w, h;
+	uint32_t bufoff;
+	int32_t seq;              // Bumped by rcgl_shm_post for each frame
+	int32_t dirty;            // Set by rcgl_shm_post, cleared once taken
+	int32_t shown;            // seq of the last frame the display showed
+	uint32_t palette[256];
+} rcgl_shm;
 
 extern uint32_t rcgl_palette[256];
 
 extern const uint32_t RCGL_PALETTE_VGA[256];
 extern const uint32_t RCGL_PALETTE_GREY[256];
 
+extern const rcgl_font RCGL_FONT_CGA;
+extern const rcgl_font RCGL_FONT_VGA;
+
 int rcgl_init(int w, int h, int ww, int wh, const char *title, int wflags);
 void rcgl_quit(void);
 int rcgl_update(void);
+uint32_t rcgl_submit(void);
+int rcgl_wait(uint32_t id);
 void rcgl_setbuf(uint8_t *b);
 uint8_t *rcgl_getbuf(void);
+const uint32_t *rcgl_getpixels(void);
 int rcgl_hasquit(void);
+int rcgl_pollevent(rcgl_event *ev);
+void rcgl_getinput(rcgl_input *in);
+int rcgl_setvsync(int mode, int hz);
+int rcgl_frame_wait(int hz);
+int rcgl_setscale(int mode, int aspw, int asph);
 void rcgl_delay(uint32_t ms);
 uint32_t rcgl_ticks(void);
 void rcgl_plot(int x, int y, uint8_t c);
+void rcgl_invalidate(int x, int y, int w, int h);
 void rcgl_setpalette(const uint32_t palette[256]);
+int rcgl_palcycle(int first, int last, int ms);
+int rcgl_palfade(const uint32_t target[256], int first, int last, uint32_t ms);
+int rcgl_palkeys(const uint32_t *pals, const uint32_t *times, int n,
+                 int first, int last, int loop);
+void rcgl_palstop(int id);
 void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c);
+void rcgl_lines(const int *xy, int n, uint8_t c);
+void rcgl_setclip(int x, int y, int w, int h);
+int rcgl_setthreads(int n);
+void rcgl_rect(int x, int y, int w, int h, uint8_t c);
+void rcgl_fillrect(int x, int y, int w, int h, uint8_t c);
+void rcgl_ellipse(int x, int y, int rx, int ry, uint8_t c);
+void rcgl_fillellipse(int x, int y, int rx, int ry, uint8_t c);
+void rcgl_circle(int x, int y, int r, uint8_t c);
+void rcgl_fillcircle(int x, int y, int r, uint8_t c);
+void rcgl_arc(int x, int y, int r, int a1, int a2, uint8_t c);
+void rcgl_triangle(int x1, int y1, int x2, int y2, int x3, int y3, uint8_t c);
+void rcgl_filltriangle(int x1, int y1, int x2, int y2, int x3, int y3,
+                       uint8_t c);
+void rcgl_polygon(const int *xy, int n, uint8_t c);
+void rcgl_fillpolygon(const int *xy, int n, uint8_t c);
+void rcgl_setfont(const rcgl_font *f);
+int rcgl_text(int x, int y, const char *str, int fg, int bg);
+void rcgl_texts(const rcgl_textitem *items, int n);
 void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt);
+rcgl_sprite *rcgl_sprite_compile(const uint8_t *b, int w, int h, int trans);
+void rcgl_sprite_draw(const rcgl_sprite *s, int x, int y, const uint8_t *plt);
+void rcgl_sprite_free(rcgl_sprite *s);
+void rcgl_blit_rect(const uint8_t *b, int pitch, int sx, int sy, int w, int h,
+                    int x, int y, int flags, int trans, const uint8_t *plt);
+rcgl_atlas *rcgl_atlas_create(const uint8_t *b, int w, int h, int pitch);
+uint8_t *rcgl_atlas_pixels(rcgl_atlas *a);
+int rcgl_atlas_add(rcgl_atlas *a, const char *name, int x, int y, int w,
+                   int h);
+int rcgl_atlas_grid(rcgl_atlas *a, int fw, int fh);
+int rcgl_atlas_find(const rcgl_atlas *a, const char *name);
+void rcgl_atlas_draw(const rcgl_atlas *a, int frame, int x, int y, int flags,
+                     int trans, const uint8_t *plt);
+void rcgl_atlas_free(rcgl_atlas *a);
+void rcgl_blit_affine(const uint8_t *b, int pitch, int w, int h,
+                      const int32_t m[6], int trans, const uint8_t *plt);
+void rcgl_blit_rotate(const uint8_t *b, int pitch, int w, int h, int x, int y,
+                      int angle, int32_t scale, int trans, const uint8_t *plt);
+void rcgl_blit_mode7(const uint8_t *b, int pitch, int w, int h,
+                     const rcgl_scanline *rows, rcgl_scanfn fn, void *data,
+                     int flags, int trans, const uint8_t *plt);
+int rcgl_layer_set(int n, const uint8_t *b, int w, int h, int trans);
+void rcgl_layer_scroll(int n, int x, int y);
+void rcgl_layer_key(int trans);
+rcgl_cmdlist *rcgl_cmd_create(void);
+void rcgl_cmd_plot(rcgl_cmdlist *l, int x, int y, uint8_t c);
+void rcgl_cmd_line(rcgl_cmdlist *l, int x1, int y1, int x2, int y2, uint8_t c);
+void rcgl_cmd_blit(rcgl_cmdlist *l, const uint8_t *b, int x, int y, int w,
+                   int h, int trans, const uint8_t *plt);
+void rcgl_cmd_sprite(rcgl_cmdlist *l, const rcgl_sprite *s, int x, int y,
+                     const uint8_t *plt);
+void rcgl_cmd_run(rcgl_cmdlist *l);
+void rcgl_cmd_defer(rcgl_cmdlist *l);
+void rcgl_cmd_free(rcgl_cmdlist *l);
+void rcgl_stats(rcgl_framestats *st);
+int rcgl_trace_start(const char *path);
+int rcgl_trace_stop(void);
+int rcgl_capture_start(const char *path);
+int rcgl_capture_stop(void);
+int rcgl_capture_export(const char *capture, const char *out, int format,
+                        int fps);
+rcgl_shm *rcgl_shm_create(const char *name);
+void rcgl_shm_destroy(void);
+rcgl_shm *rcgl_shm_attach(const char *name);
+uint8_t *rcgl_shm_buf(rcgl_shm *s);
+int32_t rcgl_shm_post(rcgl_shm *s);
+int rcgl_shm_wait(rcgl_shm *s, int32_t seq);
+void rcgl_shm_detach(rcgl_shm *s);
+int rcgl_pak_write(const char *path, const rcgl_pakitem *items, int n);
+rcgl_pak *rcgl_pak_open(const char *path);
+int rcgl_pak_count(const rcgl_pak *p);
+int rcgl_pak_find(const rcgl_pak *p, const char *name);
+const char *rcgl_pak_name(const rcgl_pak *p, int i);
+const uint32_t *rcgl_pak_palette(const rcgl_pak *p, int i);
+const uint8_t *rcgl_pak_bitmap(const rcgl_pak *p, int i, int *w, int *h);
+const rcgl_sprite *rcgl_pak_sprite(rcgl_pak *p, int i);
+void rcgl_pak_close(rcgl_pak *p);
+
+// The same, each on its own context, for more than one window or buffer
+rcgl_context *rcgl_ctx_init(int w, int h, int ww, int wh, const char *title,
+                            int wflags);
+void rcgl_ctx_quit(rcgl_context *ctx);
+rcgl_context *rcgl_getcontext(void);
+uint32_t *rcgl_ctx_palette(rcgl_context *ctx);
+int rcgl_ctx_update(rcgl_context *ctx);
+uint32_t rcgl_ctx_submit(rcgl_context *ctx);
+int rcgl_ctx_wait(rcgl_context *ctx, uint32_t id);
+void rcgl_ctx_setbuf(rcgl_context *ctx, uint8_t *b);
+uint8_t *rcgl_ctx_getbuf(rcgl_context *ctx);
+const uint32_t *rcgl_ctx_getpixels(rcgl_context *ctx);
+int rcgl_ctx_hasquit(rcgl_context *ctx);
+int rcgl_ctx_pollevent(rcgl_context *ctx, rcgl_event *ev);
+void rcgl_ctx_getinput(rcgl_context *ctx, rcgl_input *in);
+int rcgl_ctx_setvsync(rcgl_context *ctx, int mode, int hz);
+int rcgl_ctx_frame_wait(rcgl_context *ctx, int hz);
+int rcgl_ctx_setscale(rcgl_context *ctx, int mode, int aspw, int asph);
+void rcgl_ctx_plot(rcgl_context *ctx, int x, int y, uint8_t c);
+void rcgl_ctx_invalidate(rcgl_context *ctx, int x, int y, int w, int h);
+void rcgl_ctx_setpalette(rcgl_context *ctx, const uint32_t palette[256]);
+int rcgl_ctx_palcycle(rcgl_context *ctx, int first, int last, int ms);
+int rcgl_ctx_palfade(rcgl_context *ctx, const uint32_t target[256], int first,
+                     int last, uint32_t ms);
+int rcgl_ctx_palkeys(rcgl_context *ctx, const uint32_t *pals,
+                     const uint32_t *times, int n, int first, int last,
+                     int loop);
+void rcgl_ctx_palstop(rcgl_context *ctx, int id);
+void rcgl_ctx_line(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                   uint8_t c);
+void rcgl_ctx_lines(rcgl_context *ctx, const int *xy, int n, uint8_t c);
+void rcgl_ctx_setclip(rcgl_context *ctx, int x, int y, int w, int h);
+void rcgl_ctx_rect(rcgl_context *ctx, int x, int y, int w, int h, uint8_t c);
+void rcgl_ctx_fillrect(rcgl_context *ctx, int x, int y, int w, int h,
+                       uint8_t c);
+void rcgl_ctx_ellipse(rcgl_context *ctx, int x, int y, int rx, int ry,
+                      uint8_t c);
+void rcgl_ctx_fillellipse(rcgl_context *ctx, int x, int y, int rx, int ry,
+                          uint8_t c);
+void rcgl_ctx_circle(rcgl_context *ctx, int x, int y, int r, uint8_t c);
+void rcgl_ctx_fillcircle(rcgl_context *ctx, int x, int y, int r, uint8_t c);
+void rcgl_ctx_arc(rcgl_context *ctx, int x, int y, int r, int a1, int a2,
+                  uint8_t c);
+void rcgl_ctx_triangle(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                       int x3, int y3, uint8_t c);
+void rcgl_ctx_filltriangle(rcgl_context *ctx, int x1, int y1, int x2, int y2,
+                           int x3, int y3, uint8_t c);
+void rcgl_ctx_polygon(rcgl_context *ctx, const int *xy, int n, uint8_t c);
+void rcgl_ctx_fillpolygon(rcgl_context *ctx, const int *xy, int n, uint8_t c);
+void rcgl_ctx_setfont(rcgl_context *ctx, const rcgl_font *f);
+int rcgl_ctx_text(rcgl_context *ctx, int x, int y, const char *str, int fg,
+                  int bg);
+void rcgl_ctx_texts(rcgl_context *ctx, const rcgl_textitem *items, int n);
+void rcgl_ctx_blit(rcgl_context *ctx, uint8_t *b, int x, int y, int w, int h,
+                   int trans, uint8_t *plt);
+void rcgl_ctx_sprite_draw(rcgl_context *ctx, const rcgl_sprite *s, int x,
+                          int y, const uint8_t *plt);
+void rcgl_ctx_blit_rect(rcgl_context *ctx, const uint8_t *b, int pitch, int sx,
+                        int sy, int w, int h, int x, int y, int flags,
+                        int trans, const uint8_t *plt);
+void rcgl_ctx_atlas_draw(rcgl_context *ctx, const rcgl_atlas *a, int frame,
+                         int x, int y, int flags, int trans,
+                         const uint8_t *plt);
+void rcgl_ctx_blit_affine(rcgl_context *ctx, const uint8_t *b, int pitch,
+                          int w, int h, const int32_t m[6], int trans,
+                          const uint8_t *plt);
+void rcgl_ctx_blit_rotate(rcgl_context *ctx, const uint8_t *b, int pitch,
+                          int w, int h, int x, int y, int angle,
+                          int32_t scale, int trans, const uint8_t *plt);
+void rcgl_ctx_blit_mode7(rcgl_context *ctx, const uint8_t *b, int pitch,
+                         int w, int h, const rcgl_scanline *rows,
+                         rcgl_scanfn fn, void *data, int flags, int trans,
+                         const uint8_t *plt);
+int rcgl_ctx_layer_set(rcgl_context *ctx, int n, const uint8_t *b, int w,
+                       int h, int trans);
+void rcgl_ctx_layer_scroll(rcgl_context *ctx, int n, int x, int y);
+void rcgl_ctx_layer_key(rcgl_context *ctx, int trans);
+void rcgl_ctx_cmd_run(rcgl_context *ctx, rcgl_cmdlist *l);
+void rcgl_ctx_cmd_defer(rcgl_context *ctx, rcgl_cmdlist *l);
+void rcgl_ctx_stats(rcgl_context *ctx, rcgl_framestats *st);
+int rcgl_ctx_trace_start(rcgl_context *ctx, const char *path);
+int rcgl_ctx_trace_stop(rcgl_context *ctx);
+int rcgl_ctx_capture_start(rcgl_context *ctx, const char *path);
+int rcgl_ctx_capture_stop(rcgl_context *ctx);
+rcgl_shm *rcgl_ctx_shm_create(rcgl_context *ctx, const char *name);
+void rcgl_ctx_shm_destroy(rcgl_context *ctx);
 
 #endif
@@ -0,0 +1,189 @@
+/*
+ * shmtest - Draw frames in one process and show them from another, through a
+ * shared framebuffer
+ *
+ * shmtest [frames]
+ *
+ * Runs under SDL's dummy video driver, so needs no display. The display
+ * makes the region with rcgl_shm_create, and a forked writer attaches to it,
+ * filling each frame with its number before posting it and waiting for it
+ * to be shown. Fails if the writer does, if frames stop being shown for
+ * TIMEOUT seconds, or if the display doesn't end up with the last frame.
+ * The region is then destroyed and the window sent events, which must
+ * redraw from the display's own buffer rather than the unmapped region.
+ */
+#include "rcgl.h"
+
+#include <SDL2/SDL.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define WID 64
+#define HGT 40
+#define FRAMES 100000
+#define TIMEOUT 5
+
+static rcgl_shm *shm;                  // The display's side of the region
+static pid_t writerpid;
+static SDL_atomic_t finished;
+
+static int writer(const char *name, int ready, long n);
+static void expose(void);
+static int watchdog(void *data);
+
+int main(int argc, char **argv)
+{
+	rcgl_framestats st;
+	SDL_Thread *dog;
+	const uint8_t *b;
+	char name[64];
+	int ready[2];
+	uint64_t t;
+	long n = argc > 1 ? atol(argv[1]) : FRAMES;
+	int status, rval = 0;
+
+	snprintf(name, sizeof(name), "/rcgl-shmtest-%d", (int)getpid());
+	if (pipe(ready) < 0) {
+		perror("shmtest: pipe");
+		return 1;
+	}
+
+	// Forked before SDL has started any threads
+	if ((writerpid = fork()) < 0) {
+		perror("shmtest: fork");
+		return 1;
+	}
+	if (writerpid == 0) {
+		close(ready[1]);
+		_exit(writer(name, ready[0], n));
+	}
+	close(ready[0]);
+
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	if (rcgl_init(WID, HGT, WID, HGT, "RCGL Shm Test", RCGL_SURFACE) < 0
+	    || (shm = rcgl_shm_create(name)) == NULL) {
+		kill(writerpid, SIGTERM);
+		return 1;
+	}
+	if ((dog = SDL_CreateThread(watchdog, "watchdog", NULL)) == NULL) {
+		fprintf(stderr, "shmtest: Failed to start watchdog\n");
+		kill(writerpid, SIGTERM);
+		rcgl_quit();
+		return 1;
+	}
+
+	// Closing the pipe tells the writer the region is there
+	t = SDL_GetPerformanceCounter();
+	if (write(ready[1], "", 1) != 1)
+		rval = 1;
+	close(ready[1]);
+	if (waitpid(writerpid, &status, 0) < 0 || !WIFEXITED(status)
+	    || WEXITSTATUS(status) != 0)
+		rval = 1;
+	t = SDL_GetPerformanceCounter() - t;
+	SDL_AtomicSet(&finished, 1);
+	SDL_WaitThread(dog, NULL);
+
+	// Every frame was waited for, so all of them were shown
+	rcgl_stats(&st);
+	if (st.frames < n) {
+		fprintf(stderr, "shmtest: %u of %ld frames shown\n", st.frames, n);
+		rval = 1;
+	}
+	// The window surface is redrawn from the last frame on every window
+	// event, which the region mustn't be any more once it's gone
+	rcgl_shm_destroy();
+	expose();
+	rcgl_update();
+
+	b = rcgl_getbuf();
+	for (int i = 0; i < WID * HGT; i++)
+		if (b[i] != (uint8_t)n) {
+			fprintf(stderr, "shmtest: Last frame not in the buffer\n");
+			rval = 1;
+			break;
+		}
+	rcgl_quit();
+
+	printf("%ld frames in %.2f s, %.2f us each\n", n,
+	       (double)t / SDL_GetPerformanceFrequency(),
+	       (double)t * 1e6 / SDL_GetPerformanceFrequency() / (n ? n : 1));
+	if (rval)
+		fprintf(stderr, "shmtest: Failed\n");
+	return rval;
+}
+
+/*
+ * writer - Post n frames to the region name, once ready is readable
+ */
+static int writer(const char *name, int ready, long n)
+{
+	rcgl_shm *s;
+	char c;
+
+	if (read(ready, &c, 1) != 1 || (s = rcgl_shm_attach(name)) == NULL)
+		return 1;
+	for (int i = 0; i < 256; i++)
+		s->palette[i] = (uint32_t)i * 0x010101;
+	for (long f = 1; f <= n; f++) {
+		memset(rcgl_shm_buf(s), (uint8_t)f, (size_t)s->w * s->h);
+		if (rcgl_shm_wait(s, rcgl_shm_post(s)) < 0) {
+			fprintf(stderr, "shmtest: Display closed after %ld frames\n",
+			        f - 1);
+			rcgl_shm_detach(s);
+			return 1;
+		}
+	}
+	rcgl_shm_detach(s);
+	return 0;
+}
+
+/*
+ * expose - Send the display's window an expose event
+ * There's no asking which window is ours, so every id it's likely to have is
+ * sent one. Events for windows that aren't RCGL's are ignored.
+ */
+static void expose(void)
+{
+	for (uint32_t id = 1; id <= 16; id++) {
+		SDL_Event event;
+
+		SDL_zero(event);
+		event.type = SDL_WINDOWEVENT;
+		event.window.event = SDL_WINDOWEVENT_EXPOSED;
+		event.window.windowID = id;
+		SDL_PushEvent(&event);
+	}
+}
+
+/*
+ * watchdog - Fail if the display stops showing posted frames
+ */
+static int watchdog(void *data)
+{
+	int32_t last = -1;
+	int idle = 0;
+
+	(void)data;
+	while (!SDL_AtomicGet(&finished)) {
+		int32_t now = SDL_AtomicGet((SDL_atomic_t *)&shm->shown);
+
+		if (now != last) {
+			last = now;
+			idle = 0;
+		}
+		else if (++idle == TIMEOUT * 10) {
+			fprintf(stderr, "shmtest: Stuck for %d s after %d frames\n",
+			        TIMEOUT, (int)now);
+			kill(writerpid, SIGKILL);
+			exit(1);
+		}
+		SDL_Delay(100);
+	}
+	return 0;
+}
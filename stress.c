@@ -0,0 +1,94 @@
+/*
+ * stress - Hand frames to the video thread as fast as possible, to show
+ * rcgl_update and rcgl_wait never miss the frame being presented
+ *
+ * stress [updates]
+ *
+ * Runs under SDL's dummy video driver, so needs no display. Every other frame
+ * is an rcgl_update, the rest an rcgl_submit and rcgl_wait. If no frame comes
+ * back for TIMEOUT seconds the handoff has hung, and stress fails.
+ */
+#include "rcgl.h"
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define WID 64
+#define HGT 40
+#define UPDATES 2000000
+#define TIMEOUT 5
+
+static SDL_atomic_t done;              // Frames back from the video thread
+static SDL_atomic_t finished;
+
+static int watchdog(void *data);
+
+int main(int argc, char **argv)
+{
+	SDL_Thread *dog;
+	uint64_t t;
+	long n = argc > 1 ? atol(argv[1]) : UPDATES;
+	int rval = 0;
+
+	// Watched from the start, as starting and stopping can hang too
+	if ((dog = SDL_CreateThread(watchdog, "watchdog", NULL)) == NULL) {
+		fprintf(stderr, "stress: Failed to start watchdog\n");
+		return 1;
+	}
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	if (rcgl_init(WID, HGT, WID, HGT, "RCGL Stress", 0) < 0)
+		exit(1);
+
+	t = SDL_GetPerformanceCounter();
+	for (long i = 0; i < n && !rcgl_hasquit(); i++) {
+		// Always change something, so every frame has work to do
+		rcgl_plot(i % WID, (i / WID) % HGT, i);
+		if (i & 1) {
+			if (rcgl_wait(rcgl_submit()) < 0)
+				rval = 1;
+		}
+		else if (rcgl_update() < 0)
+			rval = 1;
+		SDL_AtomicAdd(&done, 1);
+	}
+	t = SDL_GetPerformanceCounter() - t;
+
+	rcgl_quit();
+	SDL_AtomicSet(&finished, 1);
+	SDL_WaitThread(dog, NULL);
+
+	printf("%d frames in %.2f s, %.2f us each\n", SDL_AtomicGet(&done),
+	       (double)t / SDL_GetPerformanceFrequency(),
+	       (double)t * 1e6 / SDL_GetPerformanceFrequency()
+	       / (SDL_AtomicGet(&done) ? SDL_AtomicGet(&done) : 1));
+	if (rval)
+		fprintf(stderr, "stress: Updates failed\n");
+	return rval;
+}
+
+/*
+ * watchdog - Fail if frames stop coming back
+ */
+static int watchdog(void *data)
+{
+	int last = -1, idle = 0;
+
+	(void)data;
+	while (!SDL_AtomicGet(&finished)) {
+		int now = SDL_AtomicGet(&done);
+
+		if (now != last) {
+			last = now;
+			idle = 0;
+		}
+		else if (++idle == TIMEOUT * 10) {
+			fprintf(stderr, "stress: Stuck for %d s after %d frames\n",
+			        TIMEOUT, now);
+			exit(1);
+		}
+		SDL_Delay(100);
+	}
+	return 0;
+}